@@ -0,0 +1,322 @@
+/*
+ *  Batch runner: executes the jobs of a manifest on a work-stealing
+ *  thread pool. Each worker keeps one diagram and its buffers for all of
+ *  its jobs, so memory is bounded by the number of workers (and the
+ *  largest job) rather than the number of jobs.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "voronoi.h"
+
+#define MAX_THREADS 256
+
+// A worker frees its diagram and buffers once they hold more than this
+// after a job
+#define RETAIN_LIMIT (256L * 1024 * 1024)
+
+// Number of paths each stage takes, the last being the output
+static const short JOB_ARGS[5] = {0, 2, 3, 3, 3};
+
+typedef struct Job {
+    int line;           // line in the manifest
+    int stage;
+    char *args[3];
+
+    // filled in by the worker that ran it
+    int err;
+    char msg[256];
+    double ms;
+    int worker;
+} job_t;
+
+typedef struct Worker worker_t;
+
+typedef struct Batch {
+    job_t *jobs;
+    long numJobs;
+    worker_t *workers;
+    int numWorkers;
+} batch_t;
+
+// Each worker owns the jobs [lo, hi) of its deque, taking from the front
+// itself while idle workers steal from the back
+struct Worker {
+    int id;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    long lo, hi;
+    batch_t *batch;
+
+    // reused from job to job
+    diagram_t *d;
+    buffer_t out, input1, input2;
+};
+
+static double elapsedMs(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// Reads a file into a reused buffer, without exiting on failure
+static bool loadFile(const char *path, buffer_t *buf) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return false;
+
+    char chunk[BUFSIZ];
+    size_t n;
+    buf->size = 0;
+    buf->failed = false;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        bufWrite(buf, chunk, n);
+    }
+    bool ok = !ferror(f) && !buf->failed;
+    fclose(f);
+    return ok;
+}
+
+static bool saveFile(const char *path, buffer_t *buf) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) return false;
+
+    bool ok = fwrite(buf->data, 1, buf->size, f) == buf->size;
+    return fclose(f) == 0 && ok;
+}
+
+// Runs one job with the worker's diagram, recording any error in the job
+static void runJob(worker_t *w, job_t *job) {
+    buffer_t *in1 = &w->input1, *in2 = &w->input2;
+    int last = JOB_ARGS[job->stage] - 1;
+
+    w->out.size = 0;
+    w->out.failed = false;
+
+    for (int i = 0; i < last; i++) {
+        if (!loadFile(job->args[i], i == 0 ? in1 : in2)) {
+            job->err = VOR_EIO;
+            snprintf(job->msg, sizeof(job->msg), "cannot read %s", job->args[i]);
+            return;
+        }
+    }
+
+    switch (job->stage) {
+        case 1:
+            job->err = vorStage1(w->d, in1->data, in1->size, &w->out);
+            break;
+        case 2:
+            job->err = vorStage2(w->d, in1->data, in1->size,
+                                 in2->data, in2->size, &w->out);
+            break;
+        case 3:
+        case 4:
+            job->err = vorStage34(w->d, in1->data, in1->size,
+                                  in2->data, in2->size, &w->out, job->stage == 4);
+            break;
+    }
+
+    if (job->err != VOR_OK) {
+        snprintf(job->msg, sizeof(job->msg), "%s", vorError(w->d));
+    } else if (!saveFile(job->args[last], &w->out)) {
+        job->err = VOR_EIO;
+        snprintf(job->msg, sizeof(job->msg), "cannot write %s", job->args[last]);
+    }
+
+    // Keep memory for the next job unless this one was unusually large
+    size_t held = vorFootprint(w->d) + w->out.cap + in1->cap + in2->cap;
+    if (held > RETAIN_LIMIT) {
+        freeDiagram(w->d);
+        bufFree(&w->out);
+        bufFree(in1);
+        bufFree(in2);
+    } else {
+        vorReset(w->d);
+    }
+}
+
+// Takes the next job from the front of our own deque
+static long popJob(worker_t *w) {
+    long index = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->lo < w->hi) index = w->lo++;
+    pthread_mutex_unlock(&w->lock);
+
+    return index;
+}
+
+// Takes a job from the back of another worker's deque
+static long stealJob(worker_t *w) {
+    batch_t *batch = w->batch;
+
+    for (int i = 1; i < batch->numWorkers; i++) {
+        worker_t *victim = &batch->workers[(w->id + i) % batch->numWorkers];
+        long index = -1;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->lo < victim->hi) index = --victim->hi;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (index != -1) return index;
+    }
+    return -1;
+}
+
+static void * workerMain(void *arg) {
+    worker_t *w = arg;
+    long index;
+
+    // Jobs are never added, so once every deque is empty we are done
+    while ((index = popJob(w)) != -1 || (index = stealJob(w)) != -1) {
+        job_t *job = &w->batch->jobs[index];
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (job->err == VOR_OK) runJob(w, job);
+        job->ms = elapsedMs(start);
+        job->worker = w->id;
+    }
+    return NULL;
+}
+
+// Splits a line into whitespace separated tokens in place
+static int splitArgs(char *line, char **tokens, int maxTokens) {
+    int n = 0;
+    while (true) {
+        while (isspace((unsigned char) *line)) line++;
+        if (*line == '\0') return n;
+        if (n == maxTokens) return n + 1;
+
+        tokens[n++] = line;
+        while (*line != '\0' && !isspace((unsigned char) *line)) line++;
+        if (*line != '\0') *line++ = '\0';
+    }
+}
+
+// Parses the manifest in place, bad lines become jobs that have already failed
+static job_t * readManifest(char *data, long *numJobs) {
+    long maxJobs = 1;
+    for (char *c = data; *c != '\0'; c++) maxJobs += *c == '\n';
+    job_t *jobs = safeMalloc(maxJobs * sizeof(job_t));
+
+    long n = 0;
+    int lineNum = 0;
+    char *line = data;
+    while (line != NULL) {
+        char *next = strchr(line, '\n');
+        if (next != NULL) *next++ = '\0';
+        lineNum++;
+
+        char *tokens[5];
+        int count = splitArgs(line, tokens, 5);
+        line = next;
+
+        // Skip blank lines and comments
+        if (count == 0 || tokens[0][0] == '#') continue;
+
+        job_t *job = &jobs[n++];
+        *job = (job_t) {.line = lineNum, .err = VOR_OK, .worker = -1};
+
+        if (tokens[0][1] != '\0' || tokens[0][0] < '1' || tokens[0][0] > '4') {
+            job->err = VOR_EARGS;
+            snprintf(job->msg, sizeof(job->msg), "Invalid Stage!");
+            continue;
+        }
+        job->stage = tokens[0][0] - '0';
+        if (count != JOB_ARGS[job->stage] + 1) {
+            job->err = VOR_EARGS;
+            snprintf(job->msg, sizeof(job->msg), "Wrong number of arguments!");
+            continue;
+        }
+        for (int i = 0; i < JOB_ARGS[job->stage]; i++) {
+            job->args[i] = tokens[i + 1];
+        }
+    }
+
+    *numJobs = n;
+    return jobs;
+}
+
+bool batch(char *manifest, char *threads) {
+    size_t len;
+    char *data = readFile(manifest, &len);
+
+    char *end;
+    long numWorkers = strtol(threads, &end, 10);
+    if (*end != '\0' || numWorkers < 1 || numWorkers > MAX_THREADS) {
+        printf("Invalid number of threads!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    batch_t b;
+    b.jobs = readManifest(data, &b.numJobs);
+    b.numWorkers = (int) min(numWorkers, max(b.numJobs, 1));
+    b.workers = safeMalloc(b.numWorkers * sizeof(worker_t));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Deal out contiguous runs of jobs, stealing evens out the rest
+    for (int i = 0; i < b.numWorkers; i++) {
+        worker_t *w = &b.workers[i];
+        *w = (worker_t) {.id = i,
+                         .lo = b.numJobs * i / b.numWorkers,
+                         .hi = b.numJobs * (i + 1) / b.numWorkers,
+                         .batch = &b,
+                         .d = vorCreate()};
+        if (w->d == NULL) {
+            printf("malloc failed, exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&w->lock, NULL);
+    }
+    for (int i = 0; i < b.numWorkers; i++) {
+        if (pthread_create(&b.workers[i].thread, NULL, workerMain, &b.workers[i]) != 0) {
+            printf("could not start thread, exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < b.numWorkers; i++) {
+        pthread_join(b.workers[i].thread, NULL);
+    }
+    double total = elapsedMs(start);
+
+    // Report in manifest order
+    long failed = 0;
+    for (long i = 0; i < b.numJobs; i++) {
+        job_t *job = &b.jobs[i];
+        if (job->err == VOR_OK) {
+            printf("Job %ld (line %d): stage %d, %s, %.3f ms on worker %d\n", i,
+                   job->line, job->stage, job->args[JOB_ARGS[job->stage] - 1],
+                   job->ms, job->worker);
+        } else {
+            failed++;
+            printf("Job %ld (line %d): failed, %s\n", i, job->line, job->msg);
+        }
+    }
+    printf("%ld of %ld jobs succeeded in %.3f ms with %d threads\n",
+           b.numJobs - failed, b.numJobs, total, b.numWorkers);
+
+    for (int i = 0; i < b.numWorkers; i++) {
+        worker_t *w = &b.workers[i];
+        pthread_mutex_destroy(&w->lock);
+        vorDestroy(w->d);
+        bufFree(&w->out);
+        bufFree(&w->input1);
+        bufFree(&w->input2);
+    }
+    free(b.workers);
+    free(b.jobs);
+    free(data);
+
+    return failed == 0;
+}
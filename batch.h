@@ -0,0 +1,16 @@
+// Runs many stage jobs from a manifest on a pool of threads
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+// Runs every job in a manifest file with the given number of threads
+// (as a string, from the command line) and prints a report of each job.
+//
+// Each manifest line is a stage followed by its usual arguments, e.g.
+//   3 data/dataset_1.csv data/polygon_square.txt output1.txt
+// Returns false if any job failed
+bool batch(char *, char *);
+
+#endif
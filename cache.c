@@ -0,0 +1,198 @@
+/*
+ *  Result cache: stage 3/4 output and trace stored on disk under a hash
+ *  of the canonical inputs, so a repeated job only reads its inputs.
+ *  Each entry keeps the inputs it was built from to rule out collisions,
+ *  and its modification time records when it was last used.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define MAGIC "VORCACH1"
+#define SUFFIX ".vc"
+#define COPY_SIZE 65536
+#define PATH_SIZE 4096
+
+typedef struct Header {
+    char magic[8];
+    uint64_t stage;
+    uint64_t inputs, out, trace;    // sizes of what follows, in order
+} header_t;
+
+// An entry found while evicting
+typedef struct Entry {
+    char *name;
+    struct timespec used;
+    off_t size;
+} entry_t;
+
+static bool entryPath(const cache_t *c, char *path) {
+    int n = snprintf(path, PATH_SIZE, "%s/%016" PRIx64 SUFFIX, c->dir, c->key);
+    return n > 0 && n < PATH_SIZE;
+}
+
+bool cacheOpen(cache_t *c, diagram_t *d, int stage) {
+    char *dir = getenv(CACHE_DIR_ENV), *size = getenv(CACHE_SIZE_ENV);
+    if (dir == NULL || dir[0] == '\0') return false;
+
+    *c = (cache_t) {.dir = dir, .stage = stage,
+                    .limit = (uint64_t) CACHE_SIZE_DEFAULT << 20};
+    if (size != NULL && size[0] != '\0') {
+        c->limit = strtoull(size, NULL, 10) << 20;
+    }
+
+    if (vorCanonical(d, &c->inputs) != VOR_OK) {
+        bufFree(&c->inputs);
+        return false;
+    }
+    c->key = hashBytes(c->inputs.data, c->inputs.size, stage);
+    return true;
+}
+
+// Appends the next n bytes of a file to a buffer
+static bool readInto(FILE *f, buffer_t *buf, uint64_t n) {
+    char block[COPY_SIZE];
+    while (n > 0) {
+        size_t want = min(n, (uint64_t) COPY_SIZE);
+        if (fread(block, 1, want, f) != want) return false;
+        bufWrite(buf, block, want);
+        n -= want;
+    }
+    return !buf->failed;
+}
+
+// Checks the next bytes of a file are the same as a buffer
+static bool readSame(FILE *f, const buffer_t *buf) {
+    char block[COPY_SIZE];
+    for (size_t done = 0; done < buf->size; ) {
+        size_t want = min(buf->size - done, (size_t) COPY_SIZE);
+        if (fread(block, 1, want, f) != want || memcmp(block, buf->data + done, want)) {
+            return false;
+        }
+        done += want;
+    }
+    return true;
+}
+
+bool cacheFetch(cache_t *c, buffer_t *out, buffer_t *trace) {
+    char path[PATH_SIZE];
+    if (!entryPath(c, path)) return false;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return false;
+
+    header_t header;
+    size_t outSize = out->size, traceSize = trace->size;
+    bool hit = fread(&header, sizeof(header), 1, f) == 1 &&
+               !memcmp(header.magic, MAGIC, sizeof(header.magic)) &&
+               header.stage == (uint64_t) c->stage &&
+               header.inputs == c->inputs.size &&
+               readSame(f, &c->inputs) &&
+               readInto(f, out, header.out) &&
+               readInto(f, trace, header.trace);
+
+    if (hit) {
+        // Mark it as used most recently
+        futimens(fileno(f), NULL);
+    } else {
+        out->size = outSize;
+        trace->size = traceSize;
+    }
+    fclose(f);
+    return hit;
+}
+
+static int compareUsed(const void *a, const void *b) {
+    const struct timespec *x = &((const entry_t *) a)->used,
+                          *y = &((const entry_t *) b)->used;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    if (x->tv_nsec != y->tv_nsec) return x->tv_nsec < y->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Removes the least recently used entries until the rest fit in the limit
+static void evict(const cache_t *c) {
+    DIR *dir = opendir(c->dir);
+    if (dir == NULL) return;
+
+    entry_t *entries = NULL;
+    size_t count = 0, cap = 0;
+    uint64_t total = 0;
+    char path[PATH_SIZE];
+    struct dirent *ent;
+
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        struct stat info;
+        if (len <= strlen(SUFFIX) || strcmp(ent->d_name + len - strlen(SUFFIX), SUFFIX) ||
+                snprintf(path, PATH_SIZE, "%s/%s", c->dir, ent->d_name) >= PATH_SIZE ||
+                stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+
+        if (count == cap) {
+            cap = max(cap * 2, 16);
+            entry_t *grown = realloc(entries, cap * sizeof(entry_t));
+            if (grown == NULL) break;
+            entries = grown;
+        }
+        char *name = strdup(ent->d_name);
+        if (name == NULL) break;
+        entries[count++] = (entry_t) {name, info.st_mtim, info.st_size};
+        total += info.st_size;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof(entry_t), compareUsed);
+    for (size_t i = 0; i < count; i++) {
+        if (total > c->limit) {
+            snprintf(path, PATH_SIZE, "%s/%s", c->dir, entries[i].name);
+            if (unlink(path) == 0 || errno == ENOENT) total -= entries[i].size;
+        }
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+void cacheStore(cache_t *c, const buffer_t *out, const buffer_t *trace) {
+    header_t header = {.magic = MAGIC, .stage = c->stage, .inputs = c->inputs.size,
+                       .out = out->size, .trace = trace->size};
+    char path[PATH_SIZE], temp[PATH_SIZE];
+
+    if (sizeof(header) + header.inputs + header.out + header.trace > c->limit ||
+            !entryPath(c, path)) {
+        return;
+    }
+    // Written under another name first, so other runs never see half of it
+    int n = snprintf(temp, PATH_SIZE, "%s/.%016" PRIx64 ".%ld.tmp", c->dir, c->key,
+                     (long) getpid());
+    if (n <= 0 || n >= PATH_SIZE) return;
+
+    if (mkdir(c->dir, 0777) != 0 && errno != EEXIST) return;
+    FILE *f = fopen(temp, "wb");
+    if (f == NULL) return;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(c->inputs.data, 1, c->inputs.size, f) == c->inputs.size &&
+              fwrite(out->data, 1, out->size, f) == out->size &&
+              fwrite(trace->data, 1, trace->size, f) == trace->size;
+    if (fclose(f) != 0 || !ok || rename(temp, path) != 0) {
+        unlink(temp);
+        return;
+    }
+    evict(c);
+}
+
+void cacheClose(cache_t *c) {
+    bufFree(&c->inputs);
+}
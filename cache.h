@@ -0,0 +1,42 @@
+// Reuses stage 3/4 results between runs with the same inputs
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "voronoi.h"
+
+// Directory of cached results, caching is off unless it is set
+#define CACHE_DIR_ENV "VORONOI2_CACHE"
+// Most the directory may hold in MiB, least recently used results go first
+#define CACHE_SIZE_ENV "VORONOI2_CACHE_MB"
+#define CACHE_SIZE_DEFAULT 256
+
+// A stage 3/4 job's place in the cache, keyed on its canonical inputs
+typedef struct Cache {
+    char *dir;
+    uint64_t limit;
+    int stage;
+    buffer_t inputs;    // from vorCanonical
+    uint64_t key;
+} cache_t;
+
+// Sets up the cache for a job whose inputs have been read by vorRead34,
+// returning false (with nothing to free) if caching is off
+bool cacheOpen(cache_t *, diagram_t *, int);
+
+// Fills in the output and trace of an earlier run with the same inputs,
+// returning false if there was none. A key whose stored inputs differ is
+// a hash collision, and is not a match
+bool cacheFetch(cache_t *, buffer_t *, buffer_t *);
+
+// Stores the output and trace of the job, then evicts the least recently
+// used results over the size limit. Failing to is not an error, the
+// result just isn't cached
+void cacheStore(cache_t *, const buffer_t *, const buffer_t *);
+
+void cacheClose(cache_t *);
+
+#endif
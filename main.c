@@ -3,9 +3,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
+#include "server.h"
 #include "stage.h"
+#include "stream.h"
 
-static const short ARGCOUNT[5] = {0, 3, 4, 4, 4};
+// Stage 5 is batch mode, given as 'b', 6 is server mode, given as 's',
+// 7 is streaming mode, given as 't' followed by stage 3 or 4, 8 is
+// what-if mode, given as 'w', 9 is window mode, given as 'v'
+// followed by stage 3 or 4, 10 is render mode, given as 'r', and 11 is
+// delta mode, given as 'd' followed by stage 3 or 4
+static const short ARGCOUNT[12] = {0, 3, 4, 4, 4, 3, 4, 6, 5, 9, 5, 6};
 
 // Checks if the arguments are in the correct format 
 int argCheck(int argc, char **argv) {
@@ -34,6 +42,27 @@ int argCheck(int argc, char **argv) {
         case '4':
             stage = 4;
             break;
+        case 'b':
+            stage = 5;
+            break;
+        case 's':
+            stage = 6;
+            break;
+        case 't':
+            stage = 7;
+            break;
+        case 'w':
+            stage = 8;
+            break;
+        case 'v':
+            stage = 9;
+            break;
+        case 'r':
+            stage = 10;
+            break;
+        case 'd':
+            stage = 11;
+            break;
         default:
             printf("Invalid Stage!\n");
             exit(EXIT_FAILURE);
@@ -63,6 +92,45 @@ void runStage(int stage, char **argv) {
         case 4:
             stage34(argv[2], argv[3], argv[4], true);
             break;
+        case 5:
+            if (!batch(argv[2], argv[3])) exit(EXIT_FAILURE);
+            break;
+        case 6:
+            if (!serve(argv[2], argv[3], argv[4])) exit(EXIT_FAILURE);
+            break;
+        case 7:
+            if (strcmp(argv[2], "3") && strcmp(argv[2], "4")) {
+                printf("Invalid Stage!\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!streamTowers(argv[3], argv[4], argv[5], argv[6], argv[2][0] == '4')) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 8:
+            whatIf(argv[2], argv[3], argv[4], argv[5]);
+            break;
+        case 9:
+            if (strcmp(argv[2], "3") && strcmp(argv[2], "4")) {
+                printf("Invalid Stage!\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!windowTowers(argv[3], argv[4], argv[5], &argv[6], argv[2][0] == '4')) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 10:
+            render(argv[2], argv[3], argv[4], argv[5]);
+            break;
+        case 11:
+            if (strcmp(argv[2], "3") && strcmp(argv[2], "4")) {
+                printf("Invalid Stage!\n");
+                exit(EXIT_FAILURE);
+            }
+            if (!deltaTowers(argv[3], argv[4], argv[5], argv[6], argv[2][0] == '4')) {
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
             printf("Invalid Stage!\n");
             exit(EXIT_FAILURE);
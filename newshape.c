@@ -1,8 +1,9 @@
 #include <assert.h>
-#include <math.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <tgmath.h>
 
 #include "newshape.h"
 #include "utils.h"
@@ -12,84 +13,321 @@
 #define SEP ","
 #define HEADER "Watchtower ID,Postcode,Population Served,Watchtower Point of Contact Name,x,y"
 
-#define PRECISION 1e-9
+// Polygon edges under each leaf of the boundary index
+#define BOUNDARY_RUN 8
 
-void printTower(FILE *f, tower_t t, double diameter) {
-    fprintf(f, "Watchtower ID: %s, Postcode: %s, "
+// Faces with more edges than this use rotating calipers for their diameter
+#define CALIPERS_MIN 32
+
+void printTower(buffer_t *f, const towers_t *t, long i, double diameter) {
+    bufPrintf(f, "Watchtower ID: %s, Postcode: %s, "
                "Population Served: %d, "
                "Watchtower Point of Contact Name: %s, "
                "x: %lf, y: %lf, "
                "Diameter of Cell: %lf\n",
-               t.id, t.postcode, t.pop, t.contact, 
-               t.coord.x, t.coord.y, diameter);
+               towerId(t, i), towerPostcode(t, i), t->pop[i], towerContact(t, i), 
+               toCalc(t->coord[i].x), toCalc(t->coord[i].y), diameter);
+}
+
+const char * towerId(const towers_t *t, long i) {
+    return t->text + t->fields[i];
+}
+
+const char * towerPostcode(const towers_t *t, long i) {
+    const char *id = towerId(t, i);
+    return id + strlen(id) + 1;
+}
+
+const char * towerContact(const towers_t *t, long i) {
+    const char *postcode = towerPostcode(t, i);
+    return postcode + strlen(postcode) + 1;
 }
 
-void printLine(FILE * const stream, line_t line) {
+// Grows a column to hold cap elements, leaving it intact on failure
+static void growColumn(diagram_t *d, void **column, size_t elemSize, size_t cap) {
+    void *grown = realloc(*column, cap * elemSize);
+    if (grown == NULL) {
+        ctxFail(&d->ctx, VOR_ENOMEM, "tower column allocation failed");
+    }
+    *column = grown;
+}
+
+// Copies a string (and its terminator) onto the end of the text column
+static void appendText(diagram_t *d, const char *str) {
+    towers_t *t = &d->towers;
+    size_t len = strlen(str) + 1;
+
+    if (t->textSize + len > t->textCap) {
+        size_t cap = max(t->textCap * 3 / 2, t->textSize + len);
+        cap = max(cap, BUFFERSIZE);
+        growColumn(d, (void **) &t->text, sizeof(char), cap);
+        t->textCap = cap;
+    }
+    memcpy(t->text + t->textSize, str, len);
+    t->textSize += len;
+}
+
+long appendTower(diagram_t *d, const char *id, const char *postcode, int pop,
+                 const char *contact, coord_t coord) {
+    towers_t *t = &d->towers;
+
+    if (t->count == t->cap) {
+        long cap = max(t->cap * 3 / 2, 16);
+        growColumn(d, (void **) &t->coord, sizeof(coord_t), cap);
+        growColumn(d, (void **) &t->face, sizeof(int), cap);
+        growColumn(d, (void **) &t->pop, sizeof(int), cap);
+        growColumn(d, (void **) &t->fields, sizeof(size_t), cap);
+        t->cap = cap;
+    }
+
+    long i = t->count;
+    t->fields[i] = t->textSize;
+    appendText(d, id);
+    appendText(d, postcode);
+    appendText(d, contact);
+    t->coord[i] = coord;
+    t->face[i] = -1;
+    t->pop[i] = pop;
+
+    // Only counted once every column is filled in
+    t->count++;
+    return i;
+}
+
+void printLine(buffer_t * const stream, line_t line) {
     if (isfinite(line.gradient)) {
-        fprintf(stream, "y = %lf * (x - %lf) + %lf\n", 
-                line.gradient, line.centre.x, line.centre.y);
+        bufPrintf(stream, "y = %lf * (x - %lf) + %lf\n", 
+                  line.gradient, toCalc(line.centre.x), toCalc(line.centre.y));
     } else if (isinf(line.gradient)) {
-        fprintf(stream, "x = %lf\n", line.centre.x);
+        bufPrintf(stream, "x = %lf\n", toCalc(line.centre.x));
     } else {
-        fprintf(stream, "Invalid Line!\n");
+        bufPrintf(stream, "Invalid Line!\n");
     }
 }
 
-bool compareDiameter(void *a, void *b) {
-    return ((face_t *) a)->diameter >= ((face_t *) b)->diameter;
+int compareDiameter(const void *a, const void *b) {
+    const face_t *f1 = *(face_t * const *) a, *f2 = *(face_t * const *) b;
+    bool none1 = isnan(f1->diameter), none2 = isnan(f2->diameter);
+    if (none1 != none2) return none1 ? -1 : 1;
+    if (none1) return (f1->id > f2->id) - (f1->id < f2->id);
+    if (f1->diameter != f2->diameter) return f1->diameter < f2->diameter ? -1 : 1;
+    return (f1->id < f2->id) - (f1->id > f2->id);
 }
 
-void freeTower(void *ptr) {
-    tower_t *tower = (tower_t *) ptr;
+// Faces and towers live in the diagram's arena, and edges in their own
+// until they are frozen, so clearing them releases everything at once
+void initDiagram(diagram_t *d) {
+    *d = (diagram_t) {.hint = -1, .threads = 1};
+    initFaceVec(&d->faces, &d->ctx);
+    initCutVec(&d->cuts, &d->ctx);
+    initCoordVec(&d->boundary.vertices, &d->ctx);
+    initBoxVec(&d->boundary.box, &d->ctx);
+    initEdgeUndoVec(&d->journal.edges, &d->ctx);
+    initFaceUndoVec(&d->journal.faces, &d->ctx);
+}
 
-    free(tower->id);
-    free(tower->postcode);
-    free(tower->contact);
-    free(tower);
+void clearDiagram(diagram_t *d) {
+    arenaReset(&d->ctx.arena);
+    arenaReset(&d->edges);
+    free(d->store);
+    d->store = NULL;
+    clearFaceVec(&d->faces);
+    clearCutVec(&d->cuts);
+    clearCoordVec(&d->boundary.vertices);
+    clearBoxVec(&d->boundary.box);
+    d->boundary.leaves = 0;
+    d->boundary.convex = false;
+    // Tower columns keep their capacity for the next diagram
+    d->towers.count = 0;
+    d->towers.textSize = 0;
+    d->index = 0;
+    d->hint = -1;
+    d->spare = NULL;
+    d->journal.on = false;
+    d->frozen = NULL;
+    d->frozenCount = 0;
 }
 
-void freeFace(void *ptr) {
-    face_t *face = (face_t *) ptr;
-    edge_t *edge, *startEdge = face->edge;
+void freeDiagram(diagram_t *d) {
+    towers_t *t = &d->towers;
+    free(t->coord);
+    free(t->face);
+    free(t->pop);
+    free(t->fields);
+    free(t->text);
+    *t = (towers_t) {0};
+
+    freeFaceVec(&d->faces);
+    freeCutVec(&d->cuts);
+    freeCoordVec(&d->boundary.vertices);
+    freeBoxVec(&d->boundary.box);
+    freeEdgeUndoVec(&d->journal.edges);
+    freeFaceUndoVec(&d->journal.faces);
+
+    arenaFree(&d->ctx.arena);
+    arenaFree(&d->edges);
+    clearDiagram(d);
+}
 
-    // We need to free this in both directions
-    edge = startEdge->next;
-    while (edge->next != NULL) {
-        edge = edge->next;
-        free(edge->prev);
+edge_t * allocEdge(diagram_t *d) {
+    if (d->spare != NULL) {
+        edge_t *edge = d->spare;
+        touchEdge(d, edge);
+        d->spare = edge->next;
+        return edge;
+    }
 
-        // In this case, we've freed everything 
-        if (edge == startEdge) {
-            free(edge);
-            free(face);
-            return;
-        }
+    edge_t *edge = arenaAlloc(&d->edges, sizeof(edge_t));
+    if (edge == NULL) {
+        ctxFail(&d->ctx, VOR_ENOMEM, "half-edge allocation failed");
     }
-    free(edge);
-    edge = startEdge;
-    while (edge->prev != NULL) {
-        edge = edge->prev;
-        free(edge->next);
+    return edge;
+}
+
+void releaseEdge(diagram_t *d, edge_t *edge) {
+    touchEdge(d, edge);
+    edge->next = d->spare;
+    d->spare = edge;
+}
+
+// First edge of a face in next order. Cells are rings, but the exterior
+// faces of the polygon are open chains ending in NULL either way
+static edge_t * firstEdge(face_t *face) {
+    edge_t *edge = face->edge;
+    while (edge->prev != NULL && edge->prev != face->edge) edge = edge->prev;
+    return edge->prev == NULL ? edge : face->edge;
+}
+
+void freezeDiagram(diagram_t *d) {
+    assert(!d->journal.on);
+    long count = 0;
+    for (face_t *face = beginFaceVec(&d->faces); face != endFaceVec(&d->faces); face++) {
+        if (face->edge == NULL) continue;
+        edge_t *first = firstEdge(face), *edge = first;
+        do {
+            count++;
+            edge = edge->next;
+        } while (edge != NULL && edge != first);
+    }
+    d->frozen = NULL;
+    d->frozenCount = 0;
+    if (count == 0) return;
+
+    edge_t *frozen = malloc(count * sizeof(edge_t)), *copy = frozen;
+    if (frozen == NULL) {
+        ctxFail(&d->ctx, VOR_ENOMEM, "frozen edge allocation failed");
+    }
+
+    // Copy each face's edges in order, leaving where each went in its old
+    // pair, which is all the old edges are still needed for
+    for (face_t *face = beginFaceVec(&d->faces); face != endFaceVec(&d->faces); face++) {
+        if (face->edge == NULL) continue;
+        edge_t *first = firstEdge(face), *edge = first;
+        do {
+            *copy = *edge;
+            edge->pair = copy++;
+            edge = edge->next;
+        } while (edge != NULL && edge != first);
+        face->edge = face->edge->pair;
+    }
+
+    for (copy = frozen; copy != frozen + count; copy++) {
+        if (copy->next != NULL) copy->next = copy->next->pair;
+        if (copy->prev != NULL) copy->prev = copy->prev->pair;
+        if (copy->pair != NULL) copy->pair = copy->pair->pair;
+    }
+
+    // Spares were in the old storage, so they go with it
+    arenaFree(&d->edges);
+    free(d->store);
+    d->spare = NULL;
+    d->store = d->frozen = frozen;
+    d->frozenCount = count;
+}
+
+void beginJournal(diagram_t *d) {
+    journal_t *j = &d->journal;
+    clearEdgeUndoVec(&j->edges);
+    clearFaceUndoVec(&j->faces);
+
+    j->arena = arenaMark(&d->ctx.arena);
+    j->edgeArena = arenaMark(&d->edges);
+    j->faceCount = d->faces.size;
+    j->towerCount = d->towers.count;
+    j->textSize = d->towers.textSize;
+    j->index = d->index;
+    j->hint = d->hint;
+    j->spare = d->spare;
+    j->frozen = d->frozen;
+    j->on = true;
+}
+
+void rollbackJournal(diagram_t *d) {
+    journal_t *j = &d->journal;
+
+    // Latest first, so each edge ends up as it was before its first change
+    for (edgeundo_t *undo = endEdgeUndoVec(&j->edges); undo != beginEdgeUndoVec(&j->edges); ) {
+        undo--;
+        *undo->edge = undo->saved;
+    }
+    for (faceundo_t *undo = endFaceUndoVec(&j->faces); undo != beginFaceUndoVec(&j->faces); ) {
+        undo--;
+        d->faces.arr[undo->face].edge = undo->edge;
+    }
+
+    arenaRewind(&d->ctx.arena, j->arena);
+    arenaRewind(&d->edges, j->edgeArena);
+    d->faces.size = j->faceCount;
+    d->towers.count = j->towerCount;
+    d->towers.textSize = j->textSize;
+    d->index = j->index;
+    d->hint = j->hint;
+    d->spare = j->spare;
+    d->frozen = j->frozen;
+    j->on = false;
+
+    // A first tower claims the interior face without making a new one
+    long inside = d->boundary.vertices.size;
+    if (inside < d->faces.size && d->faces.arr[inside].tower >= d->towers.count) {
+        d->faces.arr[inside].tower = -1;
+    }
+}
+
+void commitJournal(diagram_t *d) {
+    clearEdgeUndoVec(&d->journal.edges);
+    clearFaceUndoVec(&d->journal.faces);
+    d->journal.on = false;
+}
+
+void touchEdge(diagram_t *d, edge_t *edge) {
+    if (d->journal.on) {
+        appendEdgeUndoVec(&d->journal.edges, (edgeundo_t) {edge, *edge});
     }
-    free(edge);
-    free(face);
 }
 
-double findGradient(coord_t A, coord_t B) {
+void touchFace(diagram_t *d, int face) {
+    // Faces added since the journal started are dropped anyway
+    if (d->journal.on && face < d->journal.faceCount) {
+        appendFaceUndoVec(&d->journal.faces,
+                          (faceundo_t) {face, getFaceVec(&d->faces, face)->edge});
+    }
+}
+
+calc_t findGradient(coord_t A, coord_t B) {
     vec_t v = getVec(A, B);
 
     return v.dy / v.dx;
 }
 
-double findNormalGradient(coord_t A, coord_t B) {
+calc_t findNormalGradient(coord_t A, coord_t B) {
     vec_t v = getVec(A, B);
 
     return -v.dx / v.dy;
 }
 
 vec_t getVec(coord_t A, coord_t B) {
-    return (vec_t) {.dx = B.x - A.x,
-                    .dy = B.y - A.y};
+    return (vec_t) {.dx = toCalc(B.x - A.x),
+                    .dy = toCalc(B.y - A.y)};
 }
 
 coord_t mid(edge_t edge) {
@@ -97,15 +335,15 @@ coord_t mid(edge_t edge) {
 }
 
 coord_t mid_c(coord_t coord1, coord_t coord2) {
-    return (coord_t) {.x = (coord1.x + coord2.x) / 2, 
-                      .y = (coord1.y + coord2.y) / 2};
+    return (coord_t) {.x = toReal((toCalc(coord1.x) + toCalc(coord2.x)) / 2), 
+                      .y = toReal((toCalc(coord1.y) + toCalc(coord2.y)) / 2)};
 }
 
-double norm(vec_t v) {
+calc_t norm(vec_t v) {
     return sqrt(v.dx * v.dx + v.dy * v.dy);
 }
 
-double dot(vec_t u, vec_t v) {
+calc_t dot(vec_t u, vec_t v) {
     return u.dx * v.dx + u.dy * v.dy;
 } 
 
@@ -114,13 +352,14 @@ double dot(vec_t u, vec_t v) {
 // Note that this simply checks that the point is inside of the bounding box 
 // and does not actually check if the point is on the edge
 int contained(edge_t edge, coord_t point) {
-    double top = max(edge.start.y, edge.end.y),
-           left = min(edge.start.x, edge.end.x),
-           bot = min(edge.start.y, edge.end.y),
-           right = max(edge.start.x, edge.end.x);
-
-    return (point.y <= top + PRECISION) && (point.y + PRECISION >= bot) &&
-           (point.x <= right + PRECISION) && (point.x + PRECISION >= left);
+    calc_t top = toCalc(max(edge.start.y, edge.end.y)),
+           left = toCalc(min(edge.start.x, edge.end.x)),
+           bot = toCalc(min(edge.start.y, edge.end.y)),
+           right = toCalc(max(edge.start.x, edge.end.x));
+    calc_t x = toCalc(point.x), y = toCalc(point.y);
+
+    return (y <= top + PRECISION) && (y + PRECISION >= bot) &&
+           (x <= right + PRECISION) && (x + PRECISION >= left);
 }
 
 line_t edgeToLine(edge_t edge) {
@@ -154,6 +393,11 @@ line_t __bisectorF(face_t A, face_t B) {
  * which is the same sign as <u', v> (inner/dot product)
  */
 int onHalfPlane(edge_t edge, coord_t coord) {
+#ifdef PRECISION_FIXED
+    // Exact, as the differences fit in 31 bits and so their products in 62
+    int64_t dp = (int64_t) (edge.end.y - edge.start.y) * (coord.x - edge.start.x) -
+                 (int64_t) (edge.end.x - edge.start.x) * (coord.y - edge.start.y);
+#else
     vec_t u = getVec(edge.start, edge.end),
           v = getVec(edge.start, coord);
 
@@ -161,7 +405,8 @@ int onHalfPlane(edge_t edge, coord_t coord) {
     vec_t uPerp = {.dx = u.dy,
                    .dy = -u.dx};
     
-    double dp = dot(uPerp, v);
+    calc_t dp = dot(uPerp, v);
+#endif
 
     // 1 = yes, 0 = incident, -1 = opposite
     return dp > 0 ? 1 : dp == 0 ? 0 : -1;
@@ -171,62 +416,363 @@ coord_t intersects(line_t l1, line_t l2) {
     // Edge cases where one or both are infinity
     if (isinf(l2.gradient)) {
         if (isinf(l1.gradient)) {
-            return (coord_t) {HUGE_VAL, HUGE_VAL};
+            return (coord_t) {REAL_HUGE, REAL_HUGE};
         }
         // m1 (xc2 - xc1) + yc1 = y
-        double x = l2.centre.x;
-        double y = l1.gradient * (x - l1.centre.x) + l1.centre.y;
-        return (coord_t) {x, y};
+        calc_t x = toCalc(l2.centre.x);
+        calc_t y = l1.gradient * (x - toCalc(l1.centre.x)) + toCalc(l1.centre.y);
+        return (coord_t) {toReal(x), toReal(y)};
     } else if (isinf(l1.gradient)) {
         // m2 (xc1 - xc2) + yc2 = y
-        double x = l1.centre.x;
-        double y = l2.gradient * (x - l2.centre.x) + l2.centre.y;
-        return (coord_t) {x, y};
+        calc_t x = toCalc(l1.centre.x);
+        calc_t y = l2.gradient * (x - toCalc(l2.centre.x)) + toCalc(l2.centre.y);
+        return (coord_t) {toReal(x), toReal(y)};
     }
     
     // Check if the lines are parallel
     if (fabs(l1.gradient - l2.gradient) < PRECISION) {
-        return (coord_t) {HUGE_VAL, l1.gradient};
+        return (coord_t) {REAL_HUGE, toReal(l1.gradient)};
     } else {
         // m1 (x - xc1) + yc1 = m2 (x - xc2) + yc2
         // m1x - m2x = (m1 xc1) - (m2 xc2) - yc1 + yc2
         // x = RHS / (m1 - m2)
-        double coeff = l1.gradient - l2.gradient;
-        double rhs = l1.gradient * l1.centre.x - l2.gradient * l2.centre.x - 
-                     l1.centre.y + l2.centre.y;
-        double x = rhs / coeff;
+        calc_t x1 = toCalc(l1.centre.x), y1 = toCalc(l1.centre.y),
+               x2 = toCalc(l2.centre.x), y2 = toCalc(l2.centre.y);
+        calc_t coeff = l1.gradient - l2.gradient;
+        calc_t rhs = l1.gradient * x1 - l2.gradient * x2 - y1 + y2;
+        calc_t x = rhs / coeff;
         
         // sub back in for y
-        double y = l1.gradient * (x - l1.centre.x) + l1.centre.y;
-        return (coord_t) {x, y};
+        calc_t y = l1.gradient * (x - x1) + y1;
+        return (coord_t) {toReal(x), toReal(y)};
+    }
+}
+
+static cut_t * getCut(cuts_t *cuts, long i) {
+    return i < 2 ? &cuts->first[i] : getCutVec(cuts->more, i - 2);
+}
+
+static void addCut(cuts_t *cuts, cut_t cut) {
+    if (cuts->size < 2) {
+        cuts->first[cuts->size] = cut;
+    } else {
+        appendCutVec(cuts->more, cut);
     }
+    cuts->size++;
+}
+
+// A bisector through a vertex cuts both of its edges at (almost) the same
+// point, which with coarse coordinates can look like two separate cuts
+static void dropDuplicateCuts(cuts_t *cuts) {
+    long kept = 0;
+
+    for (long i = 0; i < cuts->size; i++) {
+        cut_t *cut = getCut(cuts, i);
+        bool duplicate = false;
+        for (long j = 0; j < kept; j++) {
+            cut_t *other = getCut(cuts, j);
+            duplicate |= fabs(toCalc(cut->coord.x) - toCalc(other->coord.x)) <= PRECISION &&
+                         fabs(toCalc(cut->coord.y) - toCalc(other->coord.y)) <= PRECISION;
+        }
+        if (!duplicate) *getCut(cuts, kept++) = *cut;
+    }
+    cuts->size = kept;
+    cuts->more->size = max(kept - 2, 0);
 }
 
 // Face is simply a pointer to an edge on the face
-list_t * findCuts(line_t line, face_t *face) {
-    list_t *cuts = initList();
+void findCuts(cuts_t *cuts, line_t line, face_t *face) {
+    cuts->size = 0;
+    clearCutVec(cuts->more);
     edge_t *cur = face->edge;
 
     do {
         coord_t point = intersects(line, edgeToLine(*cur));
 
         if (contained(*cur, point)) {
-            cut_t *cut = safeMalloc(sizeof(cut_t));
-            *cut = (cut_t) {.coord = point,
-                            .edge = cur};
-            appendList(cuts, cut);
+            addCut(cuts, (cut_t) {.coord = point,
+                                  .edge = cur});
         }
 
         cur = cur->next;
     } while (cur != face->edge);
 
-    return cuts;
+    if (cuts->size > 2) dropDuplicateCuts(cuts);
+}
+
+static box_t edgeBox(coord_t A, coord_t B) {
+    return (box_t) {.left = toCalc(min(A.x, B.x)), .right = toCalc(max(A.x, B.x)),
+                    .bot = toCalc(min(A.y, B.y)), .top = toCalc(max(A.y, B.y))};
+}
+
+static void buildBoundaryTree(boundary_t *b) {
+    long n = b->vertices.size, runs = (n + BOUNDARY_RUN - 1) / BOUNDARY_RUN;
+    b->leaves = 1;
+    while (b->leaves < runs) b->leaves *= 2;
+
+    // Unused leaves are empty boxes, which no line passes through
+    clearBoxVec(&b->box);
+    reserveBoxVec(&b->box, 2 * b->leaves);
+    for (long i = 0; i < 2 * b->leaves; i++) {
+        appendBoxVec(&b->box, (box_t) {HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL});
+    }
+    for (long i = 0; i < n; i++) {
+        box_t *leaf = getBoxVec(&b->box, b->leaves + i / BOUNDARY_RUN),
+              edge = edgeBox(*getCoordVec(&b->vertices, i), 
+                             *getCoordVec(&b->vertices, (i + 1) % n));
+        *leaf = (box_t) {min(leaf->left, edge.left), max(leaf->right, edge.right),
+                         min(leaf->bot, edge.bot), max(leaf->top, edge.top)};
+    }
+    for (long i = b->leaves - 1; i >= 1; i--) {
+        box_t *l = getBoxVec(&b->box, 2 * i), *r = getBoxVec(&b->box, 2 * i + 1);
+        *getBoxVec(&b->box, i) = (box_t) {min(l->left, r->left), max(l->right, r->right),
+                                          min(l->bot, r->bot), max(l->top, r->top)};
+    }
+}
+
+// Whether a line could have a cut that contained accepts inside a box.
+// The slack is generous, as a wrong yes only costs a visit to the children
+static bool crossesBox(line_t line, box_t *box) {
+    if (box->left > box->right) return false;
+
+    calc_t cx = toCalc(line.centre.x), cy = toCalc(line.centre.y);
+    if (isinf(line.gradient)) {
+        calc_t slack = PRECISION + 1e-6 * (fabs(cx) + fabs(box->left) + fabs(box->right));
+        return cx >= box->left - slack && cx <= box->right + slack;
+    }
+
+    // The line is monotone in x, so its extent over the box is at the sides
+    calc_t margin = 2 * PRECISION;
+    calc_t y1 = line.gradient * (box->left - margin - cx) + cy,
+           y2 = line.gradient * (box->right + margin - cx) + cy;
+    calc_t slack = PRECISION + 1e-6 * (fabs(y1) + fabs(y2) + fabs(cy) + 
+                                       fabs(box->bot) + fabs(box->top));
+    return max(y1, y2) >= box->bot - slack && min(y1, y2) <= box->top + slack;
+}
+
+static void boundaryCuts(diagram_t *d, cuts_t *cuts, line_t line, long node) {
+    boundary_t *b = &d->boundary;
+    if (!crossesBox(line, getBoxVec(&b->box, node))) return;
+
+    if (node < b->leaves) {
+        boundaryCuts(d, cuts, line, 2 * node);
+        boundaryCuts(d, cuts, line, 2 * node + 1);
+        return;
+    }
+
+    // Same test as findCuts, so the cuts found are exactly the same
+    long n = b->vertices.size, first = (node - b->leaves) * BOUNDARY_RUN;
+    for (long i = first; i < min(first + BOUNDARY_RUN, n); i++) {
+        edge_t edge = {.start = *getCoordVec(&b->vertices, i),
+                       .end = *getCoordVec(&b->vertices, (i + 1) % n)};
+        coord_t point = intersects(line, edgeToLine(edge));
+
+        if (contained(edge, point)) {
+            addCut(cuts, (cut_t) {.coord = point,
+                                  .edge = getFaceVec(&d->faces, i)->edge->pair});
+        }
+    }
+}
+
+void indexBoundary(diagram_t *d) {
+    if (d->boundary.leaves == 0) buildBoundaryTree(&d->boundary);
+}
+
+void findBoundaryCuts(diagram_t *d, cuts_t *cuts, line_t line) {
+    indexBoundary(d);
+
+    cuts->size = 0;
+    clearCutVec(cuts->more);
+    boundaryCuts(d, cuts, line, 1);
+
+    if (cuts->size > 2) dropDuplicateCuts(cuts);
+}
+
+// Positive if C is to the right of AB, like onHalfPlane
+static calc_t turn(coord_t A, coord_t B, coord_t C) {
+    vec_t u = getVec(A, B), v = getVec(A, C);
+    return u.dy * v.dx - u.dx * v.dy;
+}
+
+static bool isConvex(coordvec_t *vertices) {
+    long n = vertices->size;
+    for (long i = 0; i < n; i++) {
+        if (turn(*getCoordVec(vertices, i), *getCoordVec(vertices, (i + 1) % n),
+                 *getCoordVec(vertices, (i + 2) % n)) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether a point is further than PRECISION outside of edge i
+static bool outsideEdge(coordvec_t *vertices, long i, coord_t p) {
+    coord_t A = *getCoordVec(vertices, i), 
+            B = *getCoordVec(vertices, (i + 1) % vertices->size);
+    return turn(A, B, p) < -PRECISION * norm(getVec(A, B));
+}
+
+// The polygon is a fan of triangles around its first vertex, so a binary
+// search finds the only edge (besides the first and last) that can matter
+bool outsideBoundary(diagram_t *d, coord_t p) {
+    coordvec_t *vertices = &d->boundary.vertices;
+    long n = vertices->size;
+    if (!d->boundary.convex) return false;
+
+    coord_t apex = *getCoordVec(vertices, 0);
+    long lo = 1, hi = n - 2;
+    while (lo < hi) {
+        long i = (lo + hi + 1) / 2;
+        if (turn(apex, *getCoordVec(vertices, i), p) >= 0) {
+            lo = i;
+        } else {
+            hi = i - 1;
+        }
+    }
+
+    return outsideEdge(vertices, lo, p) || outsideEdge(vertices, 0, p) || 
+           outsideEdge(vertices, n - 1, p);
+}
+
+// Counts the polygon edges a ray from a point to the right crosses,
+// and whether the point is within PRECISION of any of them
+static void rayCrossings(boundary_t *b, coord_t p, long node, long *crossings, bool *near) {
+    box_t *box = getBoxVec(&b->box, node);
+    calc_t x = toCalc(p.x), y = toCalc(p.y);
+    if (box->left > box->right || y < box->bot - PRECISION || y > box->top + PRECISION || 
+            x > box->right + PRECISION) {
+        return;
+    }
+
+    if (node < b->leaves) {
+        rayCrossings(b, p, 2 * node, crossings, near);
+        rayCrossings(b, p, 2 * node + 1, crossings, near);
+        return;
+    }
+
+    long n = b->vertices.size, first = (node - b->leaves) * BOUNDARY_RUN;
+    for (long i = first; i < min(first + BOUNDARY_RUN, n); i++) {
+        coord_t A = *getCoordVec(&b->vertices, i), 
+                B = *getCoordVec(&b->vertices, (i + 1) % n);
+        vec_t edge = getVec(A, B), toP = getVec(A, p);
+        calc_t length = dot(edge, edge), 
+               along = length > 0 ? max(0, min(1, dot(edge, toP) / length)) : 0;
+        vec_t away = {toP.dx - along * edge.dx, toP.dy - along * edge.dy};
+        if (norm(away) <= PRECISION) *near = true;
+
+        calc_t ay = toCalc(A.y), by = toCalc(B.y);
+        if ((ay > y) != (by > y) && 
+                x < toCalc(A.x) + (y - ay) * toCalc(B.x - A.x) / (by - ay)) {
+            (*crossings)++;
+        }
+    }
+}
+
+bool outsidePolygon(diagram_t *d, coord_t p) {
+    if (!isfinite(toCalc(p.x)) || !isfinite(toCalc(p.y))) return true;
+    if (d->boundary.convex) return outsideBoundary(d, p);
+
+    long crossings = 0;
+    bool near = false;
+    indexBoundary(d);
+    rayCrossings(&d->boundary, p, 1, &crossings, &near);
+    return !near && crossings % 2 == 0;
+}
+
+// A square of the spatial hash, and the last tower put in it
+typedef struct HashSlot {
+    int64_t x, y;
+    long head;
+} slot_t;
+
+// Towers in each square of a grid, found by open addressing
+typedef struct SpatialHash {
+    slot_t *slots;
+    long mask;
+    long *next;     // the tower put in the same square before each tower
+    calc_t size;
+} hash_t;
+
+static slot_t * findSlot(hash_t *h, int64_t x, int64_t y) {
+    uint64_t key = (uint64_t) x * 0x9e3779b97f4a7c15ULL ^ (uint64_t) y * 0xc2b2ae3d27d4eb4fULL;
+    long i = (long) ((key ^ key >> 29) & h->mask);
+    while (h->slots[i].head != -1 && (h->slots[i].x != x || h->slots[i].y != y)) {
+        i = (i + 1) & h->mask;
+    }
+    return &h->slots[i];
+}
+
+static int64_t square(hash_t *h, real_t a) {
+    return (int64_t) floor(toCalc(a) / h->size);
+}
+
+// Finds a tower in the hash within DUPLICATE_DISTANCE of a point, or -1
+static long findNear(hash_t *h, const towers_t *t, coord_t p) {
+    int64_t x = square(h, p.x), y = square(h, p.y);
+    for (int64_t i = x - 1; i <= x + 1; i++) {
+        for (int64_t j = y - 1; j <= y + 1; j++) {
+            for (long k = findSlot(h, i, j)->head; k != -1; k = h->next[k]) {
+                if (norm(getVec(t->coord[k], p)) <= DUPLICATE_DISTANCE) return k;
+            }
+        }
+    }
+    return -1;
+}
+
+void validateTowers(diagram_t *d, long first, bool *keep) {
+    towers_t *t = &d->towers;
+    hash_t h = {.size = DUPLICATE_DISTANCE};
+
+    // Squares at least as wide as the distance, and wide enough
+    // that every square number fits in 64 bits
+    for (long i = 0; i < t->count; i++) {
+        calc_t x = fabs(toCalc(t->coord[i].x)), y = fabs(toCalc(t->coord[i].y));
+        if (isfinite(x) && isfinite(y)) h.size = max(h.size, max(x, y) * 0x1p-40);
+    }
+
+    // The hash is only needed here, so its room goes back to the arena
+    mark_t mark = arenaMark(&d->ctx.arena);
+    long cap = 16;
+    while (cap < 2 * t->count) cap *= 2;
+    h.mask = cap - 1;
+    h.slots = ctxMalloc(&d->ctx, cap * sizeof(slot_t));
+    h.next = ctxMalloc(&d->ctx, max(t->count, 1) * sizeof(long));
+    for (long i = 0; i < cap; i++) h.slots[i].head = -1;
+
+    // Towers already in the diagram are kept, new ones are checked first
+    for (long i = 0; i < t->count; i++) {
+        coord_t p = t->coord[i];
+        if (i >= first) {
+            keep[i - first] = false;
+            long near;
+            if (outsidePolygon(d, p)) {
+                if (d->trace != NULL) {
+                    bufPrintf(d->trace, "Tower %s (row %ld) rejected: outside polygon\n",
+                              towerId(t, i), i + 1);
+                }
+                continue;
+            } else if ((near = findNear(&h, t, p)) != -1) {
+                if (d->trace != NULL) {
+                    bufPrintf(d->trace, "Tower %s (row %ld) rejected: duplicate of %s (row %ld)\n",
+                              towerId(t, i), i + 1, towerId(t, near), near + 1);
+                }
+                continue;
+            }
+            keep[i - first] = true;
+        } else if (t->face[i] == -1) {
+            continue;
+        }
+
+        int64_t x = square(&h, p.x), y = square(&h, p.y);
+        slot_t *slot = findSlot(&h, x, y);
+        h.next[i] = slot->head;
+        *slot = (slot_t) {x, y, i};
+    }
+    arenaRewind(&d->ctx.arena, mark);
 }
 
-long findContainingFace(list_t *faceList, coord_t coord) {
-    face_t *face;
-    iterList(faceList, (void **) &face);
-    while (nextList(faceList)) {
+long findContainingFace(facevec_t *faces, coord_t coord) {
+    for (face_t *face = beginFaceVec(faces); face != endFaceVec(faces); face++) {
         // Ignore degenerate faces (technically we shouldn't need to)
         if (face->tower == -1) {
             continue;
@@ -254,19 +800,106 @@ long findContainingFace(list_t *faceList, coord_t coord) {
     return -1;
 }
 
-double diameter(face_t *face) {
+// Walks from face to face towards the point, crossing an edge the point
+// is strictly outside of. This only visits the faces between the start
+// and the point, rather than every face like findContainingFace
+long walkToFace(const diagram_t *d, coord_t coord, long start) {
+    const facevec_t *faces = &d->faces;
+    face_t *face = getFaceVec(faces, d->index - 1);
+    if (start >= 0 && start < faces->size) {
+        face_t *hint = getFaceVec(faces, start);
+        if (hint->tower != -1) face = hint;
+    }
+
+    // The walk could cycle in degenerate cases, so bound it
+    for (long steps = 0; steps < faces->size && face->tower != -1; steps++) {
+        edge_t *curEdge = face->edge, *exit = NULL;
+        bool incident = false;
+
+        do {
+            int side = onHalfPlane(*curEdge, coord);
+            if (side < 0) {
+                exit = curEdge;
+                break;
+            }
+            incident |= side == 0;
+
+            curEdge = curEdge->next;
+        } while (curEdge != face->edge);
+
+        if (exit == NULL) {
+            if (incident) break;
+            return face->id;
+        }
+
+        // Leaving the polygon, or a dangling edge
+        if (exit->pair == NULL) break;
+        face = getFaceVec(faces, exit->pair->face);
+    }
+
+    return -1;
+}
+
+long locateFace(diagram_t *d, coord_t coord) {
+    // Otherwise an outside point would search every face before failing
+    if (outsideBoundary(d, coord)) return -1;
+
+    long id = walkToFace(d, coord, d->hint);
+    if (id == -1) return findContainingFace(&d->faces, coord);
+    d->hint = id;
+    return id;
+}
+
+// Rotating calipers: for each edge, the vertex furthest from it moves 
+// forward around a convex face, so each pair worth measuring is found
+// in a single turn instead of trying every pair
+static calc_t convexDiameter(face_t *face) {
+    edge_t * const firstEdge = face->edge;
+    edge_t *edge = firstEdge, *far = firstEdge->next;
+    calc_t maxDiameter = 0;
+
+    do {
+        while (fabs(turn(edge->start, edge->end, far->end)) > 
+               fabs(turn(edge->start, edge->end, far->start))) {
+            far = far->next;
+        }
+
+        // Also the next vertex, in case it is level with far
+        maxDiameter = max(maxDiameter, norm(getVec(edge->start, far->start)));
+        maxDiameter = max(maxDiameter, norm(getVec(edge->end, far->start)));
+        maxDiameter = max(maxDiameter, norm(getVec(edge->start, far->end)));
+        maxDiameter = max(maxDiameter, norm(getVec(edge->end, far->end)));
+
+        edge = edge->next;
+    } while (edge != firstEdge);
+
+    return maxDiameter;
+}
+
+calc_t diameter(face_t *face) {
     // Degenerate face
     if (face->tower == -1) return NAN;
 
     edge_t * const firstEdge = face->edge;
     edge_t *curEdge1, *curEdge2;
-    double maxDiameter = 0;
+    calc_t maxDiameter = 0;
+
+    // Large cells (along a detailed boundary) would take too long pairwise
+    long edges = 0;
+    bool convex = true;
+    curEdge1 = firstEdge;
+    do {
+        edges++;
+        convex &= onHalfPlane(*curEdge1, curEdge1->next->end) >= 0;
+        curEdge1 = curEdge1->next;
+    } while (curEdge1 != firstEdge);
+    if (convex && edges > CALIPERS_MIN) return convexDiameter(face);
 
     curEdge1 = firstEdge;
     do {
         curEdge2 = curEdge1->next;
         do {
-            double d = norm(getVec(curEdge1->start, curEdge2->start));
+            calc_t d = norm(getVec(curEdge1->start, curEdge2->start));
             maxDiameter = max(d, maxDiameter);
 
             curEdge2 = curEdge2->next;
@@ -278,25 +911,50 @@ double diameter(face_t *face) {
     return maxDiameter;
 }
 
-void addCell(list_t *faceList, int *index, tower_t *tower, int towerId) {
-    coord_t newCentre = tower->coord;
+calc_t area(face_t *face) {
+    // Degenerate face
+    if (face->tower == -1) return NAN;
+
+    // Shoelace formula
+    edge_t *curEdge = face->edge;
+    calc_t sum = 0;
+    do {
+        sum += toCalc(curEdge->start.x) * toCalc(curEdge->end.y) - 
+               toCalc(curEdge->end.x) * toCalc(curEdge->start.y);
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    return fabs(sum) / 2;
+}
 
-    long faceId = findContainingFace(faceList, newCentre);
+void addCell(diagram_t *d, long towerId) {
+    int *index = &d->index;
+    d->frozen = NULL;
+    coord_t newCentre = d->towers.coord[towerId];
+
+    long faceId = locateFace(d, newCentre);
     if (faceId == -1) {
-        printf("Containing Face Not Found (%lf, %lf)! Exiting...\n", newCentre.x, newCentre.y);
+        if (d->trace != NULL) {
+            bufPrintf(d->trace, "Containing Face Not Found (%lf, %lf)! Exiting...\n", 
+                      toCalc(newCentre.x), toCalc(newCentre.y));
+        }
         return;
     }
-    face_t *face = getList(faceList, faceId);
+    face_t *face = getFaceVec(&d->faces, faceId);
 
     // Find our two initial intersections
     line_t bisector = bisector(newCentre, face->centre);
-    list_t *cuts = findCuts(bisector, face);
-    assert(cuts->curSize == 2);
+    cuts_t cuts = {.more = &d->cuts};
+    findCuts(&cuts, bisector, face);
+    if (cuts.size != 2) {
+        ctxFail(&d->ctx, VOR_EGEOMETRY, "bisector of (%lf, %lf) cuts its cell %ld times", 
+                toCalc(newCentre.x), toCalc(newCentre.y), cuts.size);
+    }
     
     // Construct a temporary edge for Half-Plane check
     edge_t edge = {.start = newCentre, .end = face->centre};
-    cut_t *cut1 = getList(cuts, 0),
-          *cut2 = getList(cuts, 1);
+    cut_t *cut1 = &cuts.first[0],
+          *cut2 = &cuts.first[1];
 
     // Here, we ensure that cut1 to cut2 is the minor arc 
     // That is, if we traverse exterior faces in a clockwise order
@@ -308,8 +966,8 @@ void addCell(list_t *faceList, int *index, tower_t *tower, int towerId) {
     }
 
     // Create the new edge and pair
-    edge_t *newEdge = safeMalloc(sizeof(edge_t)),
-           *newPair = safeMalloc(sizeof(edge_t));
+    edge_t *newEdge = allocEdge(d),
+           *newPair = allocEdge(d);
     *newEdge = (edge_t) {.start = cut2->coord,
                          .end = cut1->coord,
                          .pair = newPair,
@@ -320,26 +978,73 @@ void addCell(list_t *faceList, int *index, tower_t *tower, int towerId) {
                          .face = faceId,
                          .next = cut2->edge,
                          .prev = cut1->edge};
+    touchFace(d, faceId);
     face->edge = newPair;
 
-    // Create the new face
-    face_t *newFace = safeMalloc(sizeof(face_t));
-    *newFace = (face_t) {.id = *index,
-                         .centre = newCentre,
-                         .edge = newEdge,
-                         .tower = towerId};
-    appendList(faceList, newFace);
-    tower->face = (*index)++;
+    // Create the new face (which may move the others, so face is stale)
+    face_t *newFace = appendFaceVec(&d->faces, (face_t) {.id = *index,
+                                                         .centre = newCentre,
+                                                         .edge = newEdge,
+                                                         .tower = towerId});
+    d->towers.face[towerId] = (*index)++;
 
     // Note: This will set newEdge {.prev, .next}, and newPair is done already
-    updateCells(faceList, newFace, *cut1, *cut2);
+    updateCells(d, newFace, *cut1, *cut2);
+}
+
+// How far a point is outside of an edge's bounding box
+static calc_t missBy(edge_t edge, coord_t point) {
+    calc_t x = toCalc(point.x), y = toCalc(point.y);
+    calc_t dx = max(toCalc(min(edge.start.x, edge.end.x)) - x, 
+                    x - toCalc(max(edge.start.x, edge.end.x))),
+           dy = max(toCalc(min(edge.start.y, edge.end.y)) - y, 
+                    y - toCalc(max(edge.start.y, edge.end.y)));
+    return max(max(dx, dy), 0);
+}
+
+// Finds the edge where the new cell's boundary leaves a face, walking back 
+// from an edge until the one it entered by, and the point where it leaves.
+// Should rounding put that point on none of them, the edge it is closest 
+// to is used rather than walking round the face forever
+static edge_t * findExit(diagram_t *d, face_t *face, edge_t *from, edge_t *entry,
+                         coord_t *point) {
+    edge_t *closest = NULL;
+    calc_t closestMiss = HUGE_VAL;
+
+    for (edge_t *curEdge = from; curEdge != NULL && curEdge != entry; 
+            curEdge = curEdge->prev) {
+        if (curEdge->pair == NULL) continue;
+
+        // Find our two adjacent faces and construct two bisectors
+        face_t *face1 = getFaceVec(&d->faces, curEdge->face),
+               *face2 = getFaceVec(&d->faces, curEdge->pair->face);
+        line_t bisector1 = bisector(*face, *face1);
+        line_t bisector2 = bisector(*face, *face2);
+
+        coord_t intersection = intersects(bisector1, bisector2);
+        if (contained(*curEdge, intersection)) {
+            *point = intersection;
+            return curEdge;
+        }
+
+        calc_t miss = missBy(*curEdge, intersection);
+        if (miss < closestMiss) {
+            closest = curEdge;
+            closestMiss = miss;
+            *point = intersection;
+        }
+    }
 
-    freeList(cuts);
+    if (closest == NULL) {
+        ctxFail(&d->ctx, VOR_EGEOMETRY, "new cell %d has no way out of face %d",
+                face->id, entry->face);
+    }
+    return closest;
 }
 
-void updateCells(list_t *faceList, face_t *face, cut_t startCut, cut_t endCut) {
+void updateCells(diagram_t *d, face_t *face, cut_t startCut, cut_t endCut) {
     // These are our new edges
-    edge_t *prevNEdge = face->edge, *curNEdge, *curNPair, *firstNEdge;
+    edge_t *prevNEdge = face->edge, *curNEdge = NULL, *curNPair, *firstNEdge;
     // This is the edge we traverse
     edge_t *curTEdge = startCut.edge->pair, *firstTEdge;
     int startFace = startCut.edge->face;
@@ -349,12 +1054,15 @@ void updateCells(list_t *faceList, face_t *face, cut_t startCut, cut_t endCut) {
     curTEdge = endCut.edge->prev;
 
     while (curTEdge != startCut.edge) {
+        touchEdge(d, curTEdge->pair);
         curTEdge->pair->pair = NULL;
         curTEdge = curTEdge->prev;
-        free(curTEdge->next);
+        releaseEdge(d, curTEdge->next);
     }
 
     // Fixing initial face pointers
+    touchEdge(d, startCut.edge);
+    touchEdge(d, endCut.edge);
     startCut.edge->end = startCut.coord;
     endCut.edge->start = endCut.coord;
     startCut.edge->next = face->edge->pair;
@@ -370,67 +1078,57 @@ void updateCells(list_t *faceList, face_t *face, cut_t startCut, cut_t endCut) {
         }
 
         // Alloc our new split edges
-        curNEdge = safeMalloc(sizeof(edge_t));
-        curNPair = safeMalloc(sizeof(edge_t));
+        curNEdge = allocEdge(d);
+        curNPair = allocEdge(d);
         
         // This is the starting edge of this face, update pointers and vertex
         firstTEdge = curTEdge;
         curTEdge = curTEdge->prev;
+        touchEdge(d, firstTEdge);
         firstTEdge->start = prevNEdge->end;
         firstTEdge->prev = curNPair;
 
-        while (true) {
+        // Find the next intersection point
+        coord_t intersection;
+        edge_t *exit = findExit(d, face, curTEdge, firstTEdge, &intersection);
+
+        while (curTEdge != exit) {
+            // This is a useless edge, we un-reference it from its pair
             if (curTEdge->pair != NULL) {
-                // Find our two adjacent faces
-                int faceId1 = curTEdge->face,
-                    faceId2 = curTEdge->pair->face;
-                face_t *face1 = getList(faceList, faceId1),
-                       *face2 = getList(faceList, faceId2);
-
-                // Construct two bisectors
-                line_t bisector1 = bisector(*face, *face1);
-                line_t bisector2 = bisector(*face, *face2);
-
-                coord_t intersection = intersects(bisector1, bisector2);
-                
-                // Find intersection point and check if it's on our edge
-                if (contained(*curTEdge, intersection)) {
-                    // If it is on our edge, we have successfully found 
-                    // the next intersection point
-                    *curNEdge = (edge_t) {.start = prevNEdge->end,
-                                          .end = intersection,
-                                          .pair = curNPair,
-                                          .prev = prevNEdge,
-                                          .next = NULL,
-                                          .face = prevNEdge->face};
-                    *curNPair = (edge_t) {.start = intersection,
-                                          .end = prevNEdge->end,
-                                          .pair = curNEdge,
-                                          .prev = curTEdge,
-                                          .next = firstTEdge,
-                                          .face = faceId1};
-                    prevNEdge->next = curNEdge;
-                    
-                    // Update face pointer
-                    face1->edge = curNPair;
-
-                    // Update curTEdge and pointer
-                    curTEdge->end = intersection;
-                    curTEdge->next = curNPair;
-                    curTEdge = curTEdge->pair;
-                    break;
-                } else {
-                    // This is a useless edge (as below)
-                    // We un-reference it from its pair
-                    curTEdge->pair->pair = NULL;
-                }
+                touchEdge(d, curTEdge->pair);
+                curTEdge->pair->pair = NULL;
             }
 
-            // Useless edge, we traverse and free
+            // then traverse and free
             curTEdge = curTEdge->prev;
-            free(curTEdge->next);
+            releaseEdge(d, curTEdge->next);
         }
 
+        int faceId1 = curTEdge->face;
+        *curNEdge = (edge_t) {.start = prevNEdge->end,
+                              .end = intersection,
+                              .pair = curNPair,
+                              .prev = prevNEdge,
+                              .next = NULL,
+                              .face = prevNEdge->face};
+        *curNPair = (edge_t) {.start = intersection,
+                              .end = prevNEdge->end,
+                              .pair = curNEdge,
+                              .prev = curTEdge,
+                              .next = firstTEdge,
+                              .face = faceId1};
+        prevNEdge->next = curNEdge;
+        
+        // Update face pointer
+        touchFace(d, faceId1);
+        getFaceVec(&d->faces, faceId1)->edge = curNPair;
+
+        // Update curTEdge and pointer
+        touchEdge(d, curTEdge);
+        curTEdge->end = intersection;
+        curTEdge->next = curNPair;
+        curTEdge = curTEdge->pair;
+
         prevNEdge = curNEdge;
     }
 
@@ -438,86 +1136,138 @@ void updateCells(list_t *faceList, face_t *face, cut_t startCut, cut_t endCut) {
     curNEdge->next = firstNEdge;
 }
 
-void readTowers(FILE *f, list_t *towerList) {
+// Reentrant strtok, splits off the next token from a line
+static char * nextToken(char **cursor) {
+    char *start = *cursor + strspn(*cursor, SEP);
+    if (*start == '\0') return NULL;
+
+    char *end = start + strcspn(start, SEP);
+    if (*end != '\0') *end++ = '\0';
+    *cursor = end;
+    return start;
+}
+
+// Gets the next field of a tower line, failing if there is none
+static char * nextField(diagram_t *d, char **cursor, int n) {
+    char *token = nextToken(cursor);
+    if (token == NULL) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower line %d has too few fields", n);
+    }
+    return token;
+}
+
+long readTower(diagram_t *d, const char *line, size_t lineLen, int n) {
     char buffer[BUFFERSIZE];
 
-    fscanf(f, "%[^\n]s", buffer);
-    if (strcmp(HEADER, buffer)) {
-        printf("Wrong Header!\n");
-        exit(EXIT_FAILURE);
+    // Blank lines (usually at the end of the file) are skipped
+    size_t blank = 0;
+    while (blank < lineLen && isspace((unsigned char) line[blank])) blank++;
+    if (blank == lineLen) return -1;
+    if (lineLen >= BUFFERSIZE) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower line %d is too long", n);
     }
-    fscanf(f, "\n");
+    memcpy(buffer, line, lineLen);
+    buffer[lineLen] = '\0';
+
+    char *cursor = buffer, *id, *postcode, *contact, *token;
+    int pop = 0;
+    double x, y;
+
+    // ID and Postcode
+    id = nextField(d, &cursor, n);
+    postcode = nextField(d, &cursor, n);
+
+    // Population
+    token = nextField(d, &cursor, n);
+    sscanf(token, "%d", &pop);
+
+    // Contact
+    contact = nextField(d, &cursor, n);
 
-    for(int n = 1; fgets(buffer, BUFFERSIZE, f) != NULL; n++) {
-        tower_t *tower = (tower_t *) safeMalloc(sizeof(tower_t));
+    // Coords
+    token = nextField(d, &cursor, n);
+    if (sscanf(token, "%lf", &x) != 1) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower line %d has an invalid x", n);
+    }
+    token = nextField(d, &cursor, n);
+    if (sscanf(token, "%lf", &y) != 1) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower line %d has an invalid y", n);
+    }
 
-        // ID 
-        char *token = strtok(buffer, SEP);
-        tower->id = safeMalloc((strlen(token) + 1) * sizeof(char));
-        strcpy(tower->id, token);
+    return appendTower(d, id, postcode, pop, contact, 
+                       (coord_t) {toReal(x), toReal(y)});
+}
 
-        // Postcode
-        token = strtok(NULL, SEP);
-        tower->postcode = safeMalloc((strlen(token) + 1) * sizeof(char));
-        strcpy(tower->postcode, token);
+void readHeader(diagram_t *d, const char **cur, const char *end) {
+    const char *line;
+    size_t lineLen;
 
-        // Population
-        token = strtok(NULL, SEP); 
-        sscanf(token, "%d", &(tower->pop));
+    if (!scanLine(cur, end, &line, &lineLen) || lineLen != strlen(HEADER) || 
+            strncmp(HEADER, line, lineLen)) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "Wrong Header!");
+    }
+}
 
-        // Contact
-        token = strtok(NULL, SEP);
-        tower->contact = safeMalloc((strlen(token) + 1) * sizeof(char));
-        strcpy(tower->contact, token);
+void readTowers(diagram_t *d, const char *data, size_t len) {
+    const char *cur = data, *end = data + len, *line;
+    size_t lineLen;
 
-        // Coords
-        token = strtok(NULL, SEP);
-        sscanf(token, "%lf", &(tower->coord.x));
-        token = strtok(NULL, SEP);
-        sscanf(token, "%lf", &(tower->coord.y));
+    readHeader(d, &cur, end);
+    for (int n = 1; scanLine(&cur, end, &line, &lineLen); n++) {
+        readTower(d, line, lineLen, n);
+    }
+}
 
-        tower->face = -1;
+void readPolygon(diagram_t *d, const char *data, size_t len) {
+    const char *pos = data, *end = data + len;
+    double x, y;
 
-        appendList(towerList, tower);
+    clearCoordVec(&d->boundary.vertices);
+    while (scanDouble(&pos, end, &x) && scanDouble(&pos, end, &y)) {
+        appendCoordVec(&d->boundary.vertices, (coord_t) {toReal(x), toReal(y)});
     }
+    buildPolygon(d);
 }
 
-void readPolygon(FILE *f, list_t *list, int *index) {
+void buildPolygon(diagram_t *d) {
+    coordvec_t *vertices = &d->boundary.vertices;
     coord_t first, cur, prev;
 
     edge_t *cur_cw = NULL, 
            *cur_ccw = NULL,
            *out1 = NULL,
            *out2 = NULL;
-    edge_t *first_cw, *prev_cw, *first_out, *prev_out;
-    face_t *cur_face = NULL;
+    edge_t *first_cw = NULL, *prev_cw, *first_out = NULL, *prev_out;
     
-    double x, y;
     bool endLoop = false, 
          firstLoop = true;
 
-    fscanf(f, "%lf %lf", &x, &y);
-    first.x = x, first.y = y;
-    cur.x = x, cur.y = y;
+    facevec_t *faces = &d->faces;
+    int *index = &d->index;
+
+    if (vertices->size == 0) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "polygon has no vertices");
+    }
+    first = *getCoordVec(vertices, 0);
+    cur = first;
     
-    while (!endLoop) {
+    for (long n = 1; !endLoop; n++) {
         prev = cur;
         prev_cw = cur_cw;
         prev_out = out2;
 
         // Invariant here: prev and cur edges/vertices equal
 
-        if (fscanf(f, "%lf %lf", &x, &y) == 2) {
-            cur.x = x, cur.y = y;
+        if (n < vertices->size) {
+            cur = *getCoordVec(vertices, n);
         } else {  // Cycle back to start
             cur = first;
             endLoop = true;
         }
-        cur_cw = safeMalloc(sizeof(edge_t));
-        cur_ccw = safeMalloc(sizeof(edge_t));
-        cur_face = safeMalloc(sizeof(face_t));
-        out1 = safeMalloc(sizeof(edge_t));
-        out2 = safeMalloc(sizeof(edge_t));
+        cur_cw = allocEdge(d);
+        cur_ccw = allocEdge(d);
+        out1 = allocEdge(d);
+        out2 = allocEdge(d);
 
         // Initialise edges and face
         *cur_cw = (edge_t) {.start = prev,
@@ -532,10 +1282,6 @@ void readPolygon(FILE *f, list_t *list, int *index) {
                              .next = out1,
                              .prev = out2,
                              .pair = cur_cw};
-        *cur_face = (face_t) {.id = *index,
-                              .edge = cur_ccw,
-                              .defaultLine = edgeToLine(*cur_cw),
-                              .tower = -1};
         *out1 = (edge_t) {.start = prev,
                           .end = prev,
                           .face = *index, 
@@ -555,7 +1301,10 @@ void readPolygon(FILE *f, list_t *list, int *index) {
         }
 
         // Append exterior/degenerate face to face list
-        appendList(list, cur_face);
+        appendFaceVec(faces, (face_t) {.id = out2->face,
+                                       .edge = cur_ccw,
+                                       .defaultLine = edgeToLine(*cur_cw),
+                                       .tower = -1});
 
         if (prev_cw != NULL) prev_cw->next = cur_cw;
         if (prev_out != NULL) prev_out->pair = out1;
@@ -563,6 +1312,13 @@ void readPolygon(FILE *f, list_t *list, int *index) {
         // Invariant: prev is prvious of cur
     }
 
+    if (faces->size < 3) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "polygon needs at least 3 vertices");
+    }
+
+    d->boundary.leaves = 0;
+    d->boundary.convex = isConvex(&d->boundary.vertices);
+
     // Now need to link first and last edges together
     // cur is last edge
     first_cw->prev = cur_cw; cur_cw->next = first_cw;
@@ -575,9 +1331,7 @@ void readPolygon(FILE *f, list_t *list, int *index) {
         cur_cw = cur_cw->next;
     } while (cur_cw != first_cw);
 
-    cur_face = safeMalloc(sizeof(face_t));
-    *cur_face = (face_t) {.id = (*index)++,
-                          .edge = first_cw,
-                          .tower = 0};
-    appendList(list, cur_face);
+    appendFaceVec(faces, (face_t) {.id = (*index)++,
+                                   .edge = first_cw,
+                                   .tower = -1});
 }
@@ -1,29 +1,101 @@
 #ifndef NSHAPE_H
 #define NSHAPE_H
 
+#include <math.h>
+#include <stdint.h>
+
 #include "utils.h"
 
+/*
+ * Coordinate precision is chosen at build time (see the Makefile):
+ *   default          double
+ *   PRECISION_FLOAT  float, halving the size of every stored coordinate
+ *                    while still computing with doubles. Only coordinates
+ *                    shrink, not the pointers beside them: an edge_t goes
+ *                    from 64 to 48 bytes and a face_t from 72 to 56
+ *   PRECISION_FIXED  32-bit integers on a grid of 1/FIXED_SCALE units, 
+ *                    with exact integer orientation tests. Coordinates
+ *                    must stay within 2^30 grid units of the origin
+ *                    (about 10737 with the default scale)
+ *
+ * real_t is how coordinates are stored and calc_t is what is used to 
+ * compute with them. PRECISION is the tolerance for comparing coordinates
+ */
+#if defined(PRECISION_FLOAT)
+// Computing in double keeps products of coordinate differences exact, and
+// the tolerance is about one float step at coordinates of 100 (the same as
+// the fixed-point grid), as a wider one merges cuts that are really apart
+typedef float real_t;
+typedef double calc_t;
+#define PRECISION 1e-5f
+#define REAL_HUGE HUGE_VALF
+
+#elif defined(PRECISION_FIXED)
+#ifndef FIXED_SCALE
+#define FIXED_SCALE 100000
+#endif
+typedef int32_t real_t;
+typedef double calc_t;
+#define PRECISION (1.0 / FIXED_SCALE)
+#define REAL_HUGE INT32_MAX
+
+#else
+typedef double real_t;
+typedef double calc_t;
+#define PRECISION 1e-9
+#define REAL_HUGE HUGE_VAL
+#endif
+
+// Towers closer than this are duplicates, which have no bisector to speak of
+#define DUPLICATE_DISTANCE PRECISION
+
+// Converts a stored coordinate for computation or output
+static inline calc_t toCalc(real_t a) {
+#ifdef PRECISION_FIXED
+    return a / (calc_t) FIXED_SCALE;
+#else
+    return a;
+#endif
+}
+
+// Rounds a computed value to a stored coordinate
+static inline real_t toReal(calc_t a) {
+#ifdef PRECISION_FIXED
+    // Anything off the grid (including infinities) becomes REAL_HUGE
+    a = a * FIXED_SCALE;
+    if (!(fabs(a) < REAL_HUGE)) return a < 0 ? -REAL_HUGE : REAL_HUGE;
+    return (real_t) llround(a);
+#else
+    return a;
+#endif
+}
+
 typedef struct Coordinate {
-    double x, y;
+    real_t x, y;
 } coord_t;
 
-typedef struct Watchtower {
-    char *id;      // Watchtower ID
-    char *postcode;  // Postcode
-    int pop;         // Population Served
-    char *contact;   // Watchtower Point of Contact Name
-    coord_t coord;   // x, y
-
-    int face;
-} tower_t;
+// Watchtowers stored column by column and indexed by tower number.
+// Construction only touches coord and face, so these are kept apart
+// from the columns that are only needed for output
+typedef struct Watchtowers {
+    long count, cap;
+    coord_t *coord;  // x, y
+    int *face;
+    int *pop;        // Population Served
+
+    // Offset into text of "<Watchtower ID>\0<Postcode>\0<Contact Name>\0"
+    size_t *fields;
+    char *text;
+    size_t textSize, textCap;
+} towers_t;
 
 typedef struct Vector {
-    double dx, dy;
+    calc_t dx, dy;
 } vec_t;
 
 typedef struct Line {
     coord_t centre;
-    double gradient;
+    calc_t gradient;
 } line_t;
 
 typedef struct HalfEdge edge_t;
@@ -44,33 +116,162 @@ typedef struct Intersection {
 typedef struct VoronoiCell {
     int id;
     coord_t centre;
-    double diameter;
+    calc_t diameter;
     edge_t *edge;
     line_t defaultLine;
-    int tower;
+    int tower;          // -1 for exterior faces, and the interior until claimed
 } face_t;
 
+typedef struct Box {
+    calc_t left, right, bot, top;
+} box_t;
+
+DEFINE_VECTOR(facevec_t, FaceVec, face_t)
+DEFINE_VECTOR(cutvec_t, CutVec, cut_t)
+DEFINE_VECTOR(coordvec_t, CoordVec, coord_t)
+DEFINE_VECTOR(edgevec_t, EdgeVec, edge_t *)
+DEFINE_VECTOR(boxvec_t, BoxVec, box_t)
+
+// The bounding polygon as loaded, so that lines and points can be tested
+// against it without walking every exterior face. Only stage 2's cuts and
+// the rejection of outside towers use it. Cells are still clipped by
+// updateCells walking the exterior faces, which are all built up front
+// by buildPolygon. box is a segment tree
+// of bounding boxes over runs of BOUNDARY_RUN edges (node i has children
+// 2i and 2i + 1 and the leaves start at node leaves), only built once
+// something cuts it. Edge i is the one from vertex i, whose half-edges
+// are those of exterior face i, so they aren't kept here as well
+typedef struct Boundary {
+    coordvec_t vertices;
+    boxvec_t box;
+    long leaves;
+    bool convex;        // clockwise and convex, so points can be rejected
+} boundary_t;
+
+// Results of findCuts, usually on the caller's stack. A line cuts a convex
+// cell at most twice, so only a non-convex polygon spills past the first 
+// two cuts into the (reused) overflow vector
+typedef struct Cuts {
+    long size;
+    cut_t first[2];
+    cutvec_t *more;
+} cuts_t;
+
+// An existing edge, or the first edge of an existing face, as it was
+// before a change
+typedef struct EdgeUndo {
+    edge_t *edge;
+    edge_t saved;
+} edgeundo_t;
+
+typedef struct FaceUndo {
+    int face;
+    edge_t *edge;
+} faceundo_t;
+
+DEFINE_VECTOR(edgeundovec_t, EdgeUndoVec, edgeundo_t)
+DEFINE_VECTOR(faceundovec_t, FaceUndoVec, faceundo_t)
+
+// While on, records each change insertions make to what was already in
+// the diagram, so they can be rolled back in time proportional to the
+// change. New faces, edges and towers are dropped by going back to the
+// sizes below rather than being recorded
+typedef struct Journal {
+    bool on;
+    edgeundovec_t edges;
+    faceundovec_t faces;
+
+    mark_t arena, edgeArena;
+    long faceCount, towerCount;
+    size_t textSize;
+    int index, hint;
+    edge_t *spare, *frozen;
+} journal_t;
+
+// Everything belonging to one diagram, so that separate diagrams
+// can be built concurrently from different threads
+typedef struct Diagram {
+    ctx_t ctx;
+    facevec_t faces;    // faces indexed by id, exterior faces first
+    cutvec_t cuts;      // overflow space for findCuts
+    boundary_t boundary;
+    towers_t towers;
+    int index;          // id of the next face to be created
+    int hint;           // face the last point location ended in
+    edge_t *spare;      // half-edges released by updateCells, linked by next
+    arena_t edges;      // half-edges made since the last freezeDiagram
+    edge_t *store;      // array the last freezeDiagram moved the rest into
+    buffer_t *trace;    // if not NULL, receives warnings and @W/@E lines
+    bool dirty;         // set once a library call starts changing the diagram
+    int threads;        // for stage 1/2 input, see vorThreads
+    journal_t journal;
+
+    // Every half-edge in face order since freezeDiagram, or NULL once
+    // an insertion has changed the diagram again
+    edge_t *frozen;
+    long frozenCount;
+} diagram_t;
+
 // Prints a tower
-void printTower(FILE *, tower_t, double);
+void printTower(buffer_t *, const towers_t *, long, double);
+
+// Gets the ID, Postcode or Point of Contact of a tower
+const char * towerId(const towers_t *, long);
+const char * towerPostcode(const towers_t *, long);
+const char * towerContact(const towers_t *, long);
+
+// Adds a tower to the end of the columns, returning its number
+long appendTower(diagram_t *, const char *, const char *, int, const char *, coord_t);
 
 // Prints a line
-void printLine(FILE *, line_t);
+void printLine(buffer_t *, line_t);
+
+// Orders pointers to faces for qsort by diameter, smallest first, with
+// equal diameters latest face first. Faces without a cell (exterior ones)
+// come before the rest, by id
+int compareDiameter(const void *, const void *);
 
-// Compares the diameter of two faces
-// Returns true if first element is larger than or equal to second
-bool compareDiameter(void *, void *);
+// Prepares a new, empty diagram
+void initDiagram(diagram_t *);
 
-// Frees a Tower
-void freeTower(void *);
+// Empties a diagram so it can be reused, keeping its memory
+void clearDiagram(diagram_t *);
 
-// Frees a Face
-void freeFace(void *);
+// Releases all memory held by a diagram
+void freeDiagram(diagram_t *);
+
+// Allocates a half-edge, reusing released ones first
+edge_t * allocEdge(diagram_t *);
+
+// Releases a half-edge for reuse
+void releaseEdge(diagram_t *, edge_t *);
+
+// Moves the half-edges into one array once construction is done, each
+// face's ring in one run in next order and the faces in id order, so
+// the passes that only read the diagram walk it linearly, and sets frozen
+// to the array. The storage they were moved from is freed, and any later
+// insertion takes new edges from the edge arena again
+void freezeDiagram(diagram_t *);
+
+// Starts recording changes to the diagram
+void beginJournal(diagram_t *);
+
+// Undoes every change since beginJournal and stops recording
+void rollbackJournal(diagram_t *);
+
+// Keeps every change since beginJournal and stops recording
+void commitJournal(diagram_t *);
+
+// Records an edge or a face's first edge before it is changed,
+// if the journal is on
+void touchEdge(diagram_t *, edge_t *);
+void touchFace(diagram_t *, int);
 
 // Finds the gradient between two points
-double findGradient(coord_t, coord_t);
+calc_t findGradient(coord_t, coord_t);
 
 // Finds the normal gradient between two points
-double findNormalGradient(coord_t, coord_t);
+calc_t findNormalGradient(coord_t, coord_t);
 
 // Constructs a Vector from two points
 vec_t getVec(coord_t, coord_t);
@@ -82,10 +283,10 @@ coord_t mid(edge_t);
 coord_t mid_c(coord_t, coord_t);
 
 // Vector Norm
-double norm(vec_t);
+calc_t norm(vec_t);
 
 // Vector Dot Product
-double dot(vec_t, vec_t);
+calc_t dot(vec_t, vec_t);
 
 // Finds if a point is on the interior of an edge
 int contained(edge_t, coord_t);
@@ -105,26 +306,73 @@ int onHalfPlane(edge_t, coord_t);
 // Finds the Intersection Point between Two Lines
 coord_t intersects(line_t, line_t);
 
-// Finds the Intersections between a Line and a Face
-list_t * findCuts(line_t, face_t *);
+// Finds the Intersections between a Line and a Face, replacing
+// the contents of the given cuts
+void findCuts(cuts_t *, line_t, face_t *);
+
+// Builds the index findBoundaryCuts uses, if it hasn't been already
+void indexBoundary(diagram_t *);
+
+// Finds the Intersections between a Line and the polygon as loaded, in 
+// O(log n + cuts) rather than visiting every edge like findCuts, for a
+// diagram with no cells yet. Once the index is built, this only reads
+// the diagram
+void findBoundaryCuts(diagram_t *, cuts_t *, line_t);
+
+// Checks if a Point is certainly outside of a convex polygon, in O(log n)
+bool outsideBoundary(diagram_t *, coord_t);
+
+// Checks if a Point is certainly outside of the polygon, in O(log n) for
+// a convex polygon and about O(log n + edges level with it) otherwise
+bool outsidePolygon(diagram_t *, coord_t);
+
+// Checks the towers from the given number on before they are inserted,
+// setting whether to keep each. Towers outside of the polygon or within
+// DUPLICATE_DISTANCE of an earlier tower are rejected, with a line on 
+// the trace for each
+void validateTowers(diagram_t *, long, bool *);
 
 // Finds which face a Point is in
-long findContainingFace(list_t *, coord_t);
+long findContainingFace(facevec_t *, coord_t);
+
+// Walks towards a Point from the given face, returning the face it is
+// strictly inside or -1 if the walk can't tell. Only reads the diagram,
+// so any number of threads may walk it at once while nothing is inserted
+long walkToFace(const diagram_t *, coord_t, long);
+
+// Finds which face a Point is in, starting from the last face found
+long locateFace(diagram_t *, coord_t);
 
 // Calculates the diameter of a face
-double diameter(face_t *);
+calc_t diameter(face_t *);
+
+// Calculates the area of a face
+calc_t area(face_t *);
+
+// Inserts a new Voronoi Cell for a tower
+void addCell(diagram_t *, long);
+
+// Updates Cells after insertion. Where the new cell reaches the polygon,
+// this walks the exterior faces along the boundary it takes over rather
+// than using the boundary index
+void updateCells(diagram_t *, face_t *, cut_t, cut_t);
+
+// Reads a Watchtower from line n of a CSV, returning its number
+// or -1 if the line is blank
+long readTower(diagram_t *, const char *, size_t, int);
 
-// Inserts a new Voronoi Cell
-void addCell(list_t *, int *, tower_t *, int);
+// Reads the header line of a tower CSV, failing if it is wrong
+void readHeader(diagram_t *, const char **, const char *);
 
-// Updates Cells after insertion
-void updateCells(list_t *, face_t *, cut_t, cut_t);
+// Reads in a list of Watchtowers from a CSV buffer
+void readTowers(diagram_t *, const char *, size_t);
 
-// Reads in a list of Watchtowers
-void readTowers(FILE *, list_t *);
+// Reads in an Initial Polygon from a buffer of vertices
+void readPolygon(diagram_t *, const char *, size_t);
 
-// Reads in an Initial Polygon from a file
-void readPolygon(FILE *, list_t *, int *);
+// Builds the Initial Polygon's faces from the vertices already in 
+// boundary.vertices, as readPolygon does once it has read them
+void buildPolygon(diagram_t *);
 
 #define bisector(x, y) _Generic((x), coord_t: __bisectorC, face_t: __bisectorF)(x, y)
 
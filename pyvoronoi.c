@@ -0,0 +1,348 @@
+/*
+ *  CPython extension: builds a diagram in-process from NumPy coordinate
+ *  arrays, and exposes its towers, cells and edges as read-only NumPy
+ *  arrays viewing the diagram's own memory instead of parsing output.
+ *  Every view holds a reference to its Diagram, which is never changed
+ *  once built, so the memory lives as long as anything can see it.
+ *
+ *  Build with `make python`, then from this directory:
+ *      import pyvoronoi
+ *      d = pyvoronoi.Diagram(polygon, towers)
+ *      d.cell_diameter[d.tower_cell]
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <unistd.h>
+
+#include "voronoi.h"
+
+#if defined(PRECISION_FLOAT) || defined(PRECISION_FIXED)
+#error "pyvoronoi views coordinates as doubles, build it with the default precision"
+#endif
+
+typedef struct PyDiagram {
+    PyObject_HEAD
+    diagram_t *d;
+    buffer_t trace;
+} pydiagram_t;
+
+// Stands in for the data of an empty view, which has to point somewhere
+static char nothing;
+
+static PyObject * raiseError(diagram_t *d, int err) {
+    PyObject *type = err == VOR_ENOMEM ? PyExc_MemoryError :
+                     err == VOR_EIO || err == VOR_EINDEX ? PyExc_RuntimeError :
+                     PyExc_ValueError;
+    PyErr_SetString(type, vorError(d));
+    return NULL;
+}
+
+// Reads an array-like of x, y pairs as a C-contiguous (n, 2) double array,
+// which is the given array itself if it already is one
+static PyArrayObject * readPairs(PyObject *obj, const char *name) {
+    PyArrayObject *arr = (PyArrayObject *) PyArray_FROM_OTF(obj, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+    if (arr == NULL) return NULL;
+    if (PyArray_NDIM(arr) != 2 || PyArray_DIM(arr, 1) != 2) {
+        PyErr_Format(PyExc_ValueError, "%s must be an (n, 2) array", name);
+        Py_DECREF(arr);
+        return NULL;
+    }
+    return arr;
+}
+
+// Makes a read-only array over memory of the diagram, keeping it alive
+static PyObject * newView(pydiagram_t *self, void *data, int nd, npy_intp *dims,
+                          npy_intp *strides, int type) {
+    PyObject *view = PyArray_New(&PyArray_Type, nd, dims, type, strides,
+                                 data == NULL ? &nothing : data, 0, NPY_ARRAY_ALIGNED, NULL);
+    if (view == NULL) return NULL;
+
+    Py_INCREF(self);
+    if (PyArray_SetBaseObject((PyArrayObject *) view, (PyObject *) self) < 0) {
+        Py_DECREF(view);
+        return NULL;
+    }
+    return view;
+}
+
+// x, y pairs spread through an array of structs
+static PyObject * coordView(pydiagram_t *self, void *first, npy_intp count, npy_intp stride) {
+    npy_intp dims[2] = {count, 2}, strides[2] = {stride, sizeof(real_t)};
+    return newView(self, count == 0 ? NULL : first, 2, dims, strides, NPY_DOUBLE);
+}
+
+// One int or double field of an array of structs
+static PyObject * fieldView(pydiagram_t *self, void *first, npy_intp count, npy_intp stride,
+                            int type) {
+    return newView(self, count == 0 ? NULL : first, 1, &count, &stride, type);
+}
+
+static int Diagram_init(pydiagram_t *self, PyObject *args, PyObject *kwds) {
+    static char *keywords[] = {"polygon", "towers", "population", "threads", NULL};
+    PyObject *polygonObj, *towersObj = Py_None, *popObj = Py_None;
+    int threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOi", keywords, &polygonObj,
+                                     &towersObj, &popObj, &threads)) {
+        return -1;
+    }
+    if (self->d != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "diagram is already built");
+        return -1;
+    }
+
+    PyArrayObject *polygon = readPairs(polygonObj, "polygon"), *towers = NULL, *pop = NULL;
+    if (polygon == NULL) return -1;
+    if (towersObj != Py_None && (towers = readPairs(towersObj, "towers")) == NULL) goto fail;
+
+    npy_intp count = towers == NULL ? 0 : PyArray_DIM(towers, 0);
+    if (popObj != Py_None) {
+        pop = (PyArrayObject *) PyArray_FROM_OTF(popObj, NPY_INT,
+                                                 NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+        if (pop == NULL) goto fail;
+        if (PyArray_NDIM(pop) != 1 || PyArray_DIM(pop, 0) != count) {
+            PyErr_SetString(PyExc_ValueError, "population must have one entry per tower");
+            goto fail;
+        }
+    }
+
+    self->d = vorCreate();
+    if (self->d == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    vorTrace(self->d, &self->trace);
+    vorThreads(self->d, threads > 0 ? threads : sysconf(_SC_NPROCESSORS_ONLN));
+
+    // The diagram is only this object's, so other Python threads may run
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = vorLoadVertices(self->d, PyArray_DATA(polygon), PyArray_DIM(polygon, 0));
+    if (err == VOR_OK) {
+        err = vorAddPoints(self->d, towers == NULL ? NULL : PyArray_DATA(towers),
+                           pop == NULL ? NULL : PyArray_DATA(pop), count);
+    }
+    if (err == VOR_OK) err = vorMeasure(self->d);
+    Py_END_ALLOW_THREADS
+
+    if (err != VOR_OK) {
+        raiseError(self->d, err);
+        goto fail;
+    }
+    Py_DECREF(polygon);
+    Py_XDECREF(towers);
+    Py_XDECREF(pop);
+    return 0;
+
+fail:
+    Py_DECREF(polygon);
+    Py_XDECREF(towers);
+    Py_XDECREF(pop);
+    return -1;
+}
+
+static void Diagram_dealloc(pydiagram_t *self) {
+    if (self->d != NULL) vorDestroy(self->d);
+    bufFree(&self->trace);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+// Views only make sense once __init__ has built the diagram
+static diagram_t * built(pydiagram_t *self) {
+    if (self->d == NULL || self->d->frozen == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "diagram is not built");
+        return NULL;
+    }
+    return self->d;
+}
+
+static PyObject * Diagram_locate(pydiagram_t *self, PyObject *args) {
+    double x, y;
+    int face;
+    diagram_t *d = built(self);
+    if (d == NULL || !PyArg_ParseTuple(args, "dd", &x, &y)) return NULL;
+
+    int err = vorLocate(d, x, y, &face);
+    if (err != VOR_OK) return raiseError(d, err);
+    return PyLong_FromLong(face);
+}
+
+static PyObject * getTowerXY(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return coordView(self, d->towers.coord, d->towers.count, sizeof(coord_t));
+}
+
+static PyObject * getTowerCell(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return fieldView(self, d->towers.face, d->towers.count, sizeof(int), NPY_INT);
+}
+
+static PyObject * getTowerPopulation(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return fieldView(self, d->towers.pop, d->towers.count, sizeof(int), NPY_INT);
+}
+
+static PyObject * getCellTower(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return fieldView(self, &beginFaceVec(&d->faces)->tower, d->faces.size,
+                     sizeof(face_t), NPY_INT);
+}
+
+static PyObject * getCellDiameter(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return fieldView(self, &beginFaceVec(&d->faces)->diameter, d->faces.size,
+                     sizeof(face_t), NPY_DOUBLE);
+}
+
+static PyObject * getEdgeStart(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return coordView(self, &d->frozen->start, d->frozenCount, sizeof(edge_t));
+}
+
+static PyObject * getEdgeEnd(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return coordView(self, &d->frozen->end, d->frozenCount, sizeof(edge_t));
+}
+
+static PyObject * getEdgeCell(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return fieldView(self, &d->frozen->face, d->frozenCount, sizeof(edge_t), NPY_INT);
+}
+
+// Pairs are pointers in C, so their indices are worked out into a new array
+static PyObject * getEdgePair(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+
+    npy_intp count = d->frozenCount;
+    PyObject *pairs = PyArray_SimpleNew(1, &count, NPY_INTP);
+    if (pairs == NULL) return NULL;
+    npy_intp *pair = PyArray_DATA((PyArrayObject *) pairs);
+    for (npy_intp i = 0; i < count; i++) {
+        edge_t *edge = d->frozen[i].pair;
+        pair[i] = edge == NULL ? -1 : edge - d->frozen;
+    }
+    return pairs;
+}
+
+// Where each face's run of edges starts, with the end of the last appended
+static PyObject * getCellEdges(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+
+    npy_intp count = d->faces.size + 1;
+    PyObject *starts = PyArray_ZEROS(1, &count, NPY_INTP, 0);
+    if (starts == NULL) return NULL;
+    npy_intp *start = PyArray_DATA((PyArrayObject *) starts);
+
+    // Runs are in face order, so count each face's edges then sum them up
+    for (long i = 0; i < d->frozenCount; i++) start[d->frozen[i].face + 1]++;
+    for (npy_intp i = 1; i < count; i++) start[i] += start[i - 1];
+    return starts;
+}
+
+static PyObject * getFirstCell(pydiagram_t *self, void *closure) {
+    (void) closure;
+    diagram_t *d = built(self);
+    if (d == NULL) return NULL;
+    return PyLong_FromLong(d->boundary.vertices.size);
+}
+
+static PyObject * getWarnings(pydiagram_t *self, void *closure) {
+    (void) closure;
+    return PyUnicode_DecodeUTF8(self->trace.size == 0 ? "" : self->trace.data,
+                                self->trace.size, "replace");
+}
+
+static PyMethodDef DiagramMethods[] = {
+    {"locate", (PyCFunction) Diagram_locate, METH_VARARGS,
+     "locate(x, y) -> id of the face containing the point, or -1"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef DiagramGetSet[] = {
+    {"tower_xy", (getter) getTowerXY, NULL, "(towers, 2) coordinates of each tower", NULL},
+    {"tower_cell", (getter) getTowerCell, NULL,
+     "face id of each tower's cell, -1 if it was rejected", NULL},
+    {"tower_population", (getter) getTowerPopulation, NULL, "population of each tower", NULL},
+    {"cell_tower", (getter) getCellTower, NULL,
+     "tower of each face, -1 for the exterior faces", NULL},
+    {"cell_diameter", (getter) getCellDiameter, NULL,
+     "diameter of each face, NaN for the exterior faces", NULL},
+    {"edge_start", (getter) getEdgeStart, NULL, "(edges, 2) start of each half-edge", NULL},
+    {"edge_end", (getter) getEdgeEnd, NULL, "(edges, 2) end of each half-edge", NULL},
+    {"edge_cell", (getter) getEdgeCell, NULL, "face id of each half-edge", NULL},
+    {"edge_pair", (getter) getEdgePair, NULL,
+     "index of each half-edge's twin, -1 if it has none (a copy)", NULL},
+    {"cell_edges", (getter) getCellEdges, NULL,
+     "edges of face i are edge_start[cell_edges[i]:cell_edges[i + 1]], in order "
+     "round the face (a copy)", NULL},
+    {"first_cell", (getter) getFirstCell, NULL,
+     "id of the first face inside the polygon, those before are exterior", NULL},
+    {"warnings", (getter) getWarnings, NULL, "towers rejected while building", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject DiagramType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "pyvoronoi.Diagram",
+    .tp_doc = "Diagram(polygon, towers=None, population=None, threads=0)\n\n"
+              "Builds the Voronoi diagram of towers, an (n, 2) array, inside a polygon,\n"
+              "an (m, 2) array of vertices. threads=0 uses every processor. The\n"
+              "attributes are read-only NumPy views of the diagram unless noted.",
+    .tp_basicsize = sizeof(pydiagram_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) Diagram_init,
+    .tp_dealloc = (destructor) Diagram_dealloc,
+    .tp_methods = DiagramMethods,
+    .tp_getset = DiagramGetSet,
+};
+
+static struct PyModuleDef Module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "pyvoronoi",
+    .m_doc = "Voronoi diagrams built in-process, with NumPy views of the result",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pyvoronoi(void) {
+    import_array();
+    if (PyType_Ready(&DiagramType) < 0) return NULL;
+
+    PyObject *module = PyModule_Create(&Module);
+    if (module == NULL) return NULL;
+
+    Py_INCREF(&DiagramType);
+    if (PyModule_AddObject(module, "Diagram", (PyObject *) &DiagramType) < 0) {
+        Py_DECREF(&DiagramType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
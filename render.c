@@ -0,0 +1,400 @@
+/*
+ *  Rendering: each cell is walked once from the face vector and either
+ *  written as an SVG path or filled into a palette image, so drawing a
+ *  diagram doesn't go through the @W/@E trace at all. Pixel coordinates
+ *  have y going down, with a pixel of margin around the polygon.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "render.h"
+#include "utils.h"
+
+// Same colours as visualisation.py, picked by face id
+static const char *COLOURS[] = {"orange", "gold", "lime", "cyan", "blue", "indigo", "violet"};
+#define COLOUR_COUNT (sizeof(COLOURS) / sizeof(COLOURS[0]))
+
+// PNG palette: the background is 0 so that a cleared image also has
+// filter type 0 (none) at the start of every row
+#define BACKGROUND 0
+#define INK 1
+#define FIRST_COLOUR 2
+static const uint8_t PALETTE[][3] = {
+    {255, 255, 255}, {0, 0, 0},
+    {255, 165, 0}, {255, 215, 0}, {0, 255, 0}, {0, 255, 255},
+    {0, 0, 255}, {75, 0, 130}, {238, 130, 238}
+};
+
+// Deflate length codes 257 to 285, from RFC 1951
+#define MIN_RUN 3
+#define MAX_RUN 258
+static const uint16_t LENGTH_BASE[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+#define LENGTH_CODES (sizeof(LENGTH_BASE) / sizeof(LENGTH_BASE[0]))
+#define END_OF_BLOCK 256
+#define SYMBOLS 288
+
+// Largest prefix Adler-32 can sum before its 32-bit totals overflow
+#define ADLER_MOD 65521
+#define ADLER_BLOCK 5552
+
+typedef struct Point {
+    double x, y;
+} point_t;
+
+typedef struct View {
+    double left, top, scale;
+    int width, height;
+} view_t;
+
+// A cell's corners in pixels, and space for where a row crosses them
+typedef struct Outline {
+    point_t *points;
+    double *cross;
+    long size, cap;
+} outline_t;
+
+// Deflate output, which packs bits from the least significant end
+typedef struct BitWriter {
+    buffer_t *out;
+    uint64_t bits;
+    int count;
+} bits_t;
+
+typedef struct Code {
+    uint16_t bits;
+    uint8_t length;
+} code_t;
+
+// Fits the polygon's bounding box into an image `width` pixels across
+static view_t setView(diagram_t *d, int width) {
+    coordvec_t *vertices = &d->boundary.vertices;
+    if (d->faces.size == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "polygon must be loaded before rendering");
+    }
+    if (width < 3 || width > RENDER_MAX_SIZE) {
+        ctxFail(&d->ctx, VOR_EARGS, "image width %d out of range", width);
+    }
+
+    double left = INFINITY, right = -INFINITY, bot = INFINITY, top = -INFINITY;
+    for (coord_t *v = beginCoordVec(vertices); v != endCoordVec(vertices); v++) {
+        left = min(left, (double) toCalc(v->x));
+        right = max(right, (double) toCalc(v->x));
+        bot = min(bot, (double) toCalc(v->y));
+        top = max(top, (double) toCalc(v->y));
+    }
+    if (!(right > left) || !(top > bot)) {
+        ctxFail(&d->ctx, VOR_EGEOMETRY, "polygon has no area to render");
+    }
+
+    view_t view = {.left = left, .top = top, .scale = (width - 2) / (right - left),
+                   .width = width};
+    double height = ceil((top - bot) * view.scale) + 2;
+    if (height > RENDER_MAX_SIZE) {
+        ctxFail(&d->ctx, VOR_EARGS, "image height %.0f out of range", height);
+    }
+    view.height = (int) height;
+    return view;
+}
+
+static point_t toPixel(const view_t *view, coord_t coord) {
+    return (point_t) {1 + (toCalc(coord.x) - view->left) * view->scale,
+                      1 + (view->top - toCalc(coord.y)) * view->scale};
+}
+
+// Faces from the interior face on are cells, the rest lie outside the polygon
+static face_t * firstCell(diagram_t *d) {
+    return beginFaceVec(&d->faces) + d->boundary.vertices.size;
+}
+
+static void loadOutline(diagram_t *d, const view_t *view, const face_t *face,
+                        outline_t *o) {
+    edge_t *edge = face->edge;
+    o->size = 0;
+    do {
+        if (o->size == o->cap) {
+            long cap = o->cap * 2;
+            o->points = ctxRealloc(&d->ctx, o->points, o->cap * sizeof(point_t),
+                                   cap * sizeof(point_t));
+            o->cross = ctxMalloc(&d->ctx, cap * sizeof(double));
+            o->cap = cap;
+        }
+        o->points[o->size++] = toPixel(view, edge->start);
+        edge = edge->next;
+    } while (edge != face->edge);
+}
+
+static outline_t newOutline(diagram_t *d) {
+    long cap = 16;
+    return (outline_t) {.points = ctxMalloc(&d->ctx, cap * sizeof(point_t)),
+                        .cross = ctxMalloc(&d->ctx, cap * sizeof(double)),
+                        .size = 0, .cap = cap};
+}
+
+void renderSvg(diagram_t *d, int width, buffer_t *out) {
+    view_t view = setView(d, width);
+    outline_t outline = newOutline(d);
+
+    bufPrintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+              "viewBox=\"0 0 %d %d\">\n", view.width, view.height, view.width, view.height);
+    bufPrintf(out, "<g stroke=\"black\" stroke-width=\"1\" stroke-linejoin=\"round\">\n");
+    for (face_t *face = firstCell(d); face != endFaceVec(&d->faces); face++) {
+        if (face->edge == NULL) continue;
+        loadOutline(d, &view, face, &outline);
+
+        bufPrintf(out, "<path fill=\"%s\" d=\"M", COLOURS[face->id % COLOUR_COUNT]);
+        for (long i = 0; i < outline.size; i++) {
+            bufPrintf(out, "%s%.2f %.2f", i == 0 ? "" : " ", outline.points[i].x,
+                      outline.points[i].y);
+        }
+        bufPrintf(out, "Z\"/>\n");
+    }
+
+    // Towers as zero length lines with round caps, all in one path
+    bufPrintf(out, "</g>\n<path stroke=\"black\" stroke-width=\"3\" "
+              "stroke-linecap=\"round\" d=\"");
+    for (face_t *face = firstCell(d); face != endFaceVec(&d->faces); face++) {
+        if (face->edge == NULL || face->tower < 0) continue;
+        point_t tower = toPixel(&view, d->towers.coord[face->tower]);
+        bufPrintf(out, "M%.2f %.2fh0", tower.x, tower.y);
+    }
+    bufPrintf(out, "\"/>\n</svg>\n");
+}
+
+// Colours the pixels whose centres lie in a cell, row by row, leaving
+// edges already drawn by its neighbours alone
+static void fillCell(outline_t *o, const view_t *view, uint8_t *pixels, uint8_t colour) {
+    double top = INFINITY, bot = -INFINITY;
+    for (long i = 0; i < o->size; i++) {
+        top = min(top, o->points[i].y);
+        bot = max(bot, o->points[i].y);
+    }
+
+    int first = max((int) ceil(top - 0.5), 0), last = min((int) floor(bot - 0.5),
+                                                          view->height - 1);
+    for (int row = first; row <= last; row++) {
+        double y = row + 0.5;
+        long n = 0;
+        for (long i = 0, j = o->size - 1; i < o->size; j = i++) {
+            point_t a = o->points[j], b = o->points[i];
+            if ((a.y <= y) == (b.y <= y)) continue;
+
+            // Insertion sort, a cell is crossed at only a few points
+            double x = a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+            long k = n++;
+            for (; k > 0 && o->cross[k - 1] > x; k--) o->cross[k] = o->cross[k - 1];
+            o->cross[k] = x;
+        }
+
+        uint8_t *line = pixels + (size_t) row * (view->width + 1) + 1;
+        for (long k = 0; k + 1 < n; k += 2) {
+            int from = max((int) ceil(o->cross[k] - 0.5), 0),
+                to = min((int) ceil(o->cross[k + 1] - 0.5), view->width);
+            for (int x = from; x < to; x++) {
+                if (line[x] != INK) line[x] = colour;
+            }
+        }
+    }
+}
+
+static void plot(const view_t *view, uint8_t *pixels, point_t p) {
+    if (p.x < 0 || p.y < 0 || p.x >= view->width || p.y >= view->height) return;
+    pixels[(size_t) p.y * (view->width + 1) + 1 + (size_t) p.x] = INK;
+}
+
+static void drawLine(const view_t *view, uint8_t *pixels, point_t a, point_t b) {
+    double dx = b.x - a.x, dy = b.y - a.y;
+    int steps = (int) ceil(max(fabs(dx), fabs(dy)));
+    for (int i = 0; i <= steps; i++) {
+        double t = steps == 0 ? 0 : (double) i / steps;
+        plot(view, pixels, (point_t) {a.x + dx * t, a.y + dy * t});
+    }
+}
+
+static void putBits(bits_t *w, uint32_t value, int count) {
+    w->bits |= (uint64_t) value << w->count;
+    w->count += count;
+    if (w->count >= 32) {
+        uint8_t bytes[4] = {w->bits, w->bits >> 8, w->bits >> 16, w->bits >> 24};
+        bufWrite(w->out, bytes, sizeof(bytes));
+        w->bits >>= 32;
+        w->count -= 32;
+    }
+}
+
+static void flushBits(bits_t *w) {
+    for (; w->count > 0; w->count -= 8) {
+        uint8_t byte = w->bits;
+        bufWrite(w->out, &byte, 1);
+        w->bits >>= 8;
+    }
+    w->bits = 0;
+    w->count = 0;
+}
+
+// The fixed Huffman codes, reversed as deflate sends them first bit first
+static void fixedCodes(code_t *codes) {
+    for (int sym = 0; sym < SYMBOLS; sym++) {
+        int code, length;
+        if (sym < 144) {
+            code = 0x30 + sym, length = 8;
+        } else if (sym < 256) {
+            code = 0x190 + sym - 144, length = 9;
+        } else if (sym < 280) {
+            code = sym - 256, length = 7;
+        } else {
+            code = 0xc0 + sym - 280, length = 8;
+        }
+
+        uint16_t reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        codes[sym] = (code_t) {reversed, length};
+    }
+}
+
+// Compresses with one fixed Huffman block, matching only runs of the
+// previous byte. That is most of a rendered image, and needs no window
+static void deflateRuns(const uint8_t *data, size_t len, buffer_t *out) {
+    code_t codes[SYMBOLS];
+    bits_t w = {.out = out};
+    fixedCodes(codes);
+
+    // Final block, fixed codes
+    putBits(&w, 1 | 1 << 1, 3);
+    for (size_t i = 0; i < len; ) {
+        size_t run = 0;
+        if (i > 0) {
+            while (run < MAX_RUN && i + run < len && data[i + run] == data[i - 1]) run++;
+        }
+
+        if (run >= MIN_RUN) {
+            int k = LENGTH_CODES - 1;
+            while (LENGTH_BASE[k] > run) k--;
+            putBits(&w, codes[END_OF_BLOCK + 1 + k].bits, codes[END_OF_BLOCK + 1 + k].length);
+            putBits(&w, run - LENGTH_BASE[k], LENGTH_EXTRA[k]);
+            // Distance code 0, one byte back
+            putBits(&w, 0, 5);
+            i += run;
+        } else {
+            putBits(&w, codes[data[i]].bits, codes[data[i]].length);
+            i++;
+        }
+    }
+    putBits(&w, codes[END_OF_BLOCK].bits, codes[END_OF_BLOCK].length);
+    flushBits(&w);
+}
+
+static uint32_t adler32(const uint8_t *data, size_t len) {
+    uint32_t a = 1, b = 0;
+    while (len > 0) {
+        size_t n = min(len, (size_t) ADLER_BLOCK);
+        len -= n;
+        for (; n > 0; n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return b << 16 | a;
+}
+
+static void crcTable(uint32_t *table) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+}
+
+static uint32_t crc(const uint32_t *table, const uint8_t *data, size_t len) {
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < len; i++) c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+static void putUint32(uint8_t *p, uint32_t n) {
+    p[0] = n >> 24;
+    p[1] = n >> 16;
+    p[2] = n >> 8;
+    p[3] = n;
+}
+
+// Starts a PNG chunk, leaving room for its length, and returns where it is
+static size_t beginChunk(buffer_t *out, const char *type) {
+    size_t at = out->size;
+    bufWrite(out, "\0\0\0\0", 4);
+    bufWrite(out, type, 4);
+    return at;
+}
+
+// Fills in the length of the chunk at `at` and appends its CRC
+static void endChunk(buffer_t *out, size_t at, const uint32_t *table) {
+    if (out->failed) return;
+    uint8_t *chunk = (uint8_t *) out->data + at, sum[4];
+    size_t len = out->size - at - 8;
+    putUint32(chunk, len);
+    putUint32(sum, crc(table, chunk + 4, len + 4));
+    bufWrite(out, sum, sizeof(sum));
+}
+
+void renderPng(diagram_t *d, int width, buffer_t *out) {
+    view_t view = setView(d, width);
+    outline_t outline = newOutline(d);
+
+    // Rows of palette indices, each led by its filter type
+    size_t size = (size_t) (view.width + 1) * view.height;
+    uint8_t *pixels = ctxMalloc(&d->ctx, size);
+    memset(pixels, BACKGROUND, size);
+
+    for (face_t *face = firstCell(d); face != endFaceVec(&d->faces); face++) {
+        if (face->edge == NULL) continue;
+        loadOutline(d, &view, face, &outline);
+
+        fillCell(&outline, &view, pixels, FIRST_COLOUR + face->id % COLOUR_COUNT);
+        for (long i = 0, j = outline.size - 1; i < outline.size; j = i++) {
+            drawLine(&view, pixels, outline.points[j], outline.points[i]);
+        }
+        if (face->tower >= 0) {
+            plot(&view, pixels, toPixel(&view, d->towers.coord[face->tower]));
+        }
+    }
+
+    uint32_t table[256];
+    uint8_t header[13] = {0}, sum[4];
+    crcTable(table);
+    bufWrite(out, "\x89PNG\r\n\x1a\n", 8);
+
+    // 8 bit palette indices, no interlacing
+    size_t at = beginChunk(out, "IHDR");
+    putUint32(header, view.width);
+    putUint32(header + 4, view.height);
+    header[8] = 8;
+    header[9] = 3;
+    bufWrite(out, header, sizeof(header));
+    endChunk(out, at, table);
+
+    at = beginChunk(out, "PLTE");
+    bufWrite(out, PALETTE, sizeof(PALETTE));
+    endChunk(out, at, table);
+
+    // A zlib stream: header, deflate data, then Adler-32 of the pixels
+    at = beginChunk(out, "IDAT");
+    bufWrite(out, "\x78\x01", 2);
+    deflateRuns(pixels, size, out);
+    putUint32(sum, adler32(pixels, size));
+    bufWrite(out, sum, sizeof(sum));
+    endChunk(out, at, table);
+
+    at = beginChunk(out, "IEND");
+    endChunk(out, at, table);
+}
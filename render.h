@@ -0,0 +1,20 @@
+// Draws a built diagram straight from its faces, as SVG or PNG
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "newshape.h"
+
+// Widest image that may be asked for, in pixels either way
+#define RENDER_MAX_SIZE 32768
+
+// Writes an SVG `int` pixels wide (the height follows the polygon), with
+// one path per cell filled by face id like visualisation.py, then a dot
+// for each tower
+void renderSvg(diagram_t *, int, buffer_t *);
+
+// Writes the same picture as a palette PNG, filling cells with a scanline
+// rasteriser and compressing runs of the same colour
+void renderPng(diagram_t *, int, buffer_t *);
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ *  Server mode: keeps a diagram resident and answers requests over a
+ *  Unix domain socket or a stdin/stdout pipe
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "voronoi.h"
+
+// Longest request accepted, longer ones are answered with an error
+#define MAX_REQUEST 4096
+#define READ_SIZE 65536
+
+typedef enum {KEEP, CLOSE, STOP} status_t;
+
+// Writes a whole buffer to a file descriptor
+static bool writeAll(int fd, buffer_t *buf) {
+    size_t done = 0;
+    while (done < buf->size) {
+        ssize_t n = write(fd, buf->data + done, buf->size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    buf->size = 0;
+    return true;
+}
+
+// Finds an interior face by id, or NULL
+static face_t * getCell(diagram_t *d, const char *args) {
+    int id;
+    if (sscanf(args, "%d", &id) != 1 || id < 0 || id >= d->faces.size) {
+        return NULL;
+    }
+    face_t *face = getFaceVec(&d->faces, id);
+    return face->tower == -1 ? NULL : face;
+}
+
+static void cellRequest(diagram_t *d, const char *args, buffer_t *out) {
+    face_t *face = getCell(d, args);
+    if (face == NULL) {
+        bufPrintf(out, "ERR no such cell\n");
+        return;
+    }
+
+    int edges = 0;
+    edge_t *curEdge = face->edge;
+    do {
+        edges++;
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    bufPrintf(out, "OK %d %s %d %lf %lf %d\n", face->id, towerId(&d->towers, face->tower),
+              d->towers.pop[face->tower], diameter(face), area(face), edges);
+}
+
+static void edgesRequest(diagram_t *d, const char *args, buffer_t *out) {
+    face_t *face = getCell(d, args);
+    if (face == NULL) {
+        bufPrintf(out, "ERR no such cell\n");
+        return;
+    }
+
+    int edges = 0;
+    edge_t *curEdge = face->edge;
+    do {
+        edges++;
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    bufPrintf(out, "OK %d", edges);
+    do {
+        bufPrintf(out, " %lf %lf %lf %lf", toCalc(curEdge->start.x), toCalc(curEdge->start.y),
+                  toCalc(curEdge->end.x), toCalc(curEdge->end.y));
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+    bufPrintf(out, "\n");
+}
+
+static void locateRequest(diagram_t *d, const char *args, buffer_t *out) {
+    double x, y;
+    int face;
+
+    if (sscanf(args, "%lf %lf", &x, &y) != 2) {
+        bufPrintf(out, "ERR expected LOCATE <x> <y>\n");
+    } else if (vorLocate(d, x, y, &face) != VOR_OK) {
+        bufPrintf(out, "ERR %s\n", vorError(d));
+    } else if (face == -1) {
+        bufPrintf(out, "ERR outside polygon\n");
+    } else {
+        face_t *cell = getFaceVec(&d->faces, face);
+        bufPrintf(out, "OK %d %s\n", face, towerId(&d->towers, cell->tower));
+    }
+}
+
+static void addRequest(diagram_t *d, const char *args, buffer_t *out) {
+    int face;
+
+    if (vorInsertTower(d, args, strlen(args), &face) != VOR_OK) {
+        bufPrintf(out, "ERR %s\n", vorError(d));
+    } else if (face == -1) {
+        bufPrintf(out, "ERR outside polygon\n");
+    } else {
+        bufPrintf(out, "OK %d\n", face);
+    }
+}
+
+// Answers a single request, given as a NUL-terminated line
+static status_t handle(diagram_t *d, char *line, buffer_t *out) {
+    char *args = line + strcspn(line, " \t");
+    if (*args != '\0') *args++ = '\0';
+
+    // Lookups walk the edges, which are laid out again the first time
+    // after an ADD rather than after every one
+    bool lookup = !strcmp(line, "LOCATE") || !strcmp(line, "CELL") || !strcmp(line, "EDGES");
+    if (lookup && vorFreeze(d) != VOR_OK) {
+        bufPrintf(out, "ERR %s\n", vorError(d));
+    } else if (!strcmp(line, "LOCATE")) {
+        locateRequest(d, args, out);
+    } else if (!strcmp(line, "CELL")) {
+        cellRequest(d, args, out);
+    } else if (!strcmp(line, "EDGES")) {
+        edgesRequest(d, args, out);
+    } else if (!strcmp(line, "ADD")) {
+        addRequest(d, args, out);
+    } else if (!strcmp(line, "QUIT")) {
+        return CLOSE;
+    } else if (!strcmp(line, "SHUTDOWN")) {
+        return STOP;
+    } else if (line[0] != '\0') {
+        bufPrintf(out, "ERR unknown request %s\n", line);
+    }
+    return KEEP;
+}
+
+// Serves one connection until it closes. All complete requests from each
+// read are answered before the responses are written back together
+static status_t serveStream(diagram_t *d, int in, int out) {
+    char *input = safeMalloc(MAX_REQUEST + READ_SIZE);
+    size_t have = 0;
+    bool skipping = false, eof = false;
+    buffer_t responses = {0};
+    status_t status = KEEP;
+
+    while (status == KEEP) {
+        ssize_t n = read(in, input + have, MAX_REQUEST + READ_SIZE - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || (n == 0 && have == 0)) {
+            status = CLOSE;
+            break;
+        }
+        // A last request may end without a line break, so end it with one
+        eof = n == 0;
+        if (eof) input[have++] = '\n';
+        have += n;
+
+        char *line = input, *end = input + have, *newline;
+        while (status == KEEP && (newline = memchr(line, '\n', end - line)) != NULL) {
+            *newline = '\0';
+            if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+
+            if (skipping) {
+                skipping = false;
+            } else {
+                status = handle(d, line, &responses);
+            }
+            line = newline + 1;
+        }
+
+        // Keep the partial request, unless it is already too long
+        have = end - line;
+        memmove(input, line, have);
+        if (have > MAX_REQUEST) {
+            if (!skipping) bufPrintf(&responses, "ERR request too long\n");
+            skipping = true;
+            have = 0;
+        }
+
+        if (responses.failed || !writeAll(out, &responses) || (eof && status == KEEP)) {
+            status = CLOSE;
+        }
+    }
+
+    bufFree(&responses);
+    free(input);
+    return status;
+}
+
+static bool listenOn(diagram_t *d, const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("socket path %s is too long\n", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return false;
+    }
+
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        perror(path);
+        close(sock);
+        return false;
+    }
+
+    status_t status = KEEP;
+    while (status != STOP) {
+        int client = accept(sock, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        status = serveStream(d, client, client);
+        close(client);
+    }
+
+    close(sock);
+    unlink(path);
+    return status == STOP;
+}
+
+bool serve(char *towers, char *polygon, char *path) {
+    size_t towersLen, polygonLen;
+    char *csv = readFile(towers, &towersLen),
+         *vertices = readFile(polygon, &polygonLen);
+
+    diagram_t *d = vorCreate();
+    if (d == NULL) {
+        printf("malloc failed, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    if (vorLoadPolygon(d, vertices, polygonLen) != VOR_OK ||
+            vorAddTowers(d, csv, towersLen) != VOR_OK || vorFreeze(d) != VOR_OK) {
+        printf("%s, exiting...\n", vorError(d));
+        exit(EXIT_FAILURE);
+    }
+    free(csv);
+    free(vertices);
+
+    // A client hanging up shouldn't take the server down with it
+    signal(SIGPIPE, SIG_IGN);
+
+    bool ok = true;
+    if (!strcmp(path, "-")) {
+        serveStream(d, STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        ok = listenOn(d, path);
+    }
+
+    vorDestroy(d);
+    return ok;
+}
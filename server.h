@@ -0,0 +1,23 @@
+// Serves queries against a resident diagram over a line protocol
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+
+// Builds the diagram from a tower file and polygon file once, then
+// answers requests on a Unix domain socket at the given path, or on
+// stdin/stdout if the path is "-". One request per line:
+//
+//   LOCATE <x> <y>    ->  OK <face> <tower_id>
+//   CELL <face>       ->  OK <face> <tower_id> <population> <diameter> <area> <num_edges>
+//   EDGES <face>      ->  OK <num_edges> <x1> <y1> <x2> <y2> ...
+//   ADD <csv_row>     ->  OK <face>
+//   QUIT                  closes the connection
+//   SHUTDOWN              stops the server
+//
+// Failures are answered with ERR <message>. Requests may be pipelined,
+// and responses come back in order. Returns false if the server failed
+bool serve(char *, char *, char *);
+
+#endif
@@ -1,152 +1,177 @@
-#include <assert.h>
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
 #include <stdio.h>
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#include "newshape.h"
+#include "cache.h"
+#include "render.h"
 #include "stage.h"
-
-#define BUFFERSIZE 512
-
-void stage1(char *point, char *out) {
-    FILE *pf, *of;
-    char buffer[BUFFERSIZE];
-
-    pf = safeOpen(point, "r");
-    of = safeOpen(out, "w");
-    while (fgets(buffer, BUFFERSIZE, pf) != NULL) {
-        // Get two points
-        coord_t A, B;
-        if (sscanf(buffer, "%lf %lf %lf %lf", &A.x, &A.y, &B.x, &B.y) != 4) {
-            break;
-        }
-        // and print its bisector
-        printLine(of, bisector(A, B));
+#include "voronoi.h"
+
+#define THREADS_ENV "VORONOI2_THREADS"
+
+// Writes a buffer out to a file, exiting if it could not be written
+static void writeFile(const char *path, buffer_t *buf) {
+    FILE *f = safeOpen(path, "wb");
+    if (buf->size > 0) fwrite(buf->data, 1, buf->size, f);
+    bool ok = !buf->failed && !ferror(f);
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        printf("cannot write %s\n", path);
+        exit(EXIT_FAILURE);
     }
-    
-    fclose(pf); fclose(of);
 }
 
-void stage2(char *point, char *polygon, char *out) {
-    FILE *f;
-    char buffer[BUFFERSIZE];
-
-    int index = 0;
-    list_t *lineList = initList(),
-           *faceList = initList();
-    faceList->freeElem = freeFace;
-
-    // First read a list of vertices
-    f = safeOpen(point, "r");
-    while (fgets(buffer, BUFFERSIZE, f) != NULL) {
-        // Get two points
-        coord_t A, B;
-        if (sscanf(buffer, "%lf %lf %lf %lf", &A.x, &A.y, &B.x, &B.y) != 4) {
-            break;
-        }
-        
-        // Construct line and add to list
-        line_t *line = safeMalloc(sizeof(line_t));
-        *line = bisector(A, B);
-        appendList(lineList, line);
-    }
-    fclose(f);
-
-    // Now we read the initial polygon like A1
-    f = safeOpen(polygon, "r"); 
-    readPolygon(f, faceList, &index);
-    fclose(f);
-
-    // Loop through each bisector then each edge
-    f = safeOpen(out, "w");
-    line_t *line;
-    iterList(lineList, (void **) &line);
-    while (nextList(lineList)) {
-        list_t *cuts = findCuts(*line, getList(faceList, index - 1));
-
-        // Should always have 2 intersections
-        assert(cuts->curSize == 2);
-        cut_t *i1 = getList(cuts, 0),
-              *i2 = getList(cuts, 1);
-        
-        fprintf(f, "From Edge %d (%lf, %lf) to Edge %d (%lf, %lf)\n",
-                i1->edge->pair->face, i1->coord.x, i1->coord.y,
-                i2->edge->pair->face, i2->coord.x, i2->coord.y);
-        freeList(cuts);
+// Allocates a diagram, exiting on failure like safeMalloc
+static diagram_t * newDiagram(void) {
+    diagram_t *d = vorCreate();
+    if (d == NULL) {
+        printf("malloc failed, exiting...\n");
+        exit(EXIT_FAILURE);
     }
+    return d;
+}
 
-    freeList(faceList);
-    freeList(lineList);
-    fclose(f);
+// Allocates a diagram using every processor for stage 1/2 input and for
+// locating towers ahead of insertion, or THREADS_ENV threads if it is set
+static diagram_t * newThreadedDiagram(void) {
+    diagram_t *d = newDiagram();
+    char *threads = getenv(THREADS_ENV);
+    vorThreads(d, threads != NULL ? atoi(threads) : sysconf(_SC_NPROCESSORS_ONLN));
+    return d;
 }
 
-void stage34(char *towers, char *polygon, char *out, bool sorted) {
-    FILE *f;
-
-    int index = 0;
-
-    tower_t *tower;
-    face_t *face;
-    list_t *towerList = initList(),
-           *faceList = initList();
-    towerList->freeElem = freeTower;
-    faceList->freeElem = freeFace;
-    faceList->cmp = compareDiameter;
-
-    f = safeOpen(polygon, "r"); 
-    readPolygon(f, faceList, &index);
-    fclose(f);
-
-    f = safeOpen(towers, "r");
-    readTowers(f, towerList);
-    fclose(f);
-
-    iterList(towerList, (void **) &tower);
-    nextList(towerList);
-    tower->face = index - 1;
-    face_t *firstFace = getList(faceList, index - 1);
-    firstFace->centre = tower->coord;
-
-    while (nextList(towerList)) {
-        addCell(faceList, &index, tower, towerList->index - 1);
+// Reports a failed library call and exits
+static void check(diagram_t *d, int err) {
+    if (err != VOR_OK) {
+        printf("%s, exiting...\n", vorError(d));
+        exit(EXIT_FAILURE);
     }
+}
 
-    // Calculate diameter
-    iterList(faceList, (void **) &face);
-    while (nextList(faceList)) {
-        face->diameter = diameter(face);
-    }
+void stage1(char *point, char *out) {
+    mapped_t points = mapFile(point);
+    diagram_t *d = newThreadedDiagram();
+    buffer_t buf = {0};
 
-    if (sorted) {
-        iiSortList(faceList);
-    }
+    check(d, vorStage1(d, points.data, points.len, &buf));
+    writeFile(out, &buf);
+
+    bufFree(&buf);
+    vorDestroy(d);
+    unmapFile(&points);
+}
+
+void stage2(char *point, char *polygon, char *out) {
+    mapped_t points = mapFile(point),
+             vertices = mapFile(polygon);
+    diagram_t *d = newThreadedDiagram();
+    buffer_t buf = {0};
+
+    check(d, vorStage2(d, points.data, points.len, vertices.data, vertices.len, &buf));
+    writeFile(out, &buf);
+
+    bufFree(&buf);
+    vorDestroy(d);
+    unmapFile(&points);
+    unmapFile(&vertices);
+}
 
-    iterList(faceList, (void **) &face);
-    while (nextList(faceList)) {
-        edge_t *curEdge = face->edge;
-        if (face->tower != -1) {
-            tower_t *tower = getList(towerList, face->tower);
-            printf("@W%ld %lf %lf\n", faceList->index - 1, tower->coord.x, tower->coord.y);
+void stage34(char *towers, char *polygon, char *out, bool sorted) {
+    size_t towersLen, polygonLen;
+    char *csv = readFile(towers, &towersLen),
+         *vertices = readFile(polygon, &polygonLen);
+    diagram_t *d = newThreadedDiagram();
+    buffer_t buf = {0}, trace = {0};
+
+    cache_t cache;
+
+    // Warnings and edges for visualisation.py go to stdout as before
+    vorTrace(d, &trace);
+    int err = vorRead34(d, csv, towersLen, vertices, polygonLen);
+
+    // Only building is cached, so only what it traces is stored
+    if (err == VOR_OK) {
+        bool cached = cacheOpen(&cache, d, sorted ? 4 : 3);
+        if (!cached || !cacheFetch(&cache, &buf, &trace)) {
+            size_t traced = trace.size;
+            err = vorBuild34(d, &buf, sorted);
+            if (cached && err == VOR_OK) {
+                buffer_t built = {.data = trace.data + traced, .size = trace.size - traced};
+                cacheStore(&cache, &buf, &built);
+            }
         }
-        do {
-            if (curEdge == NULL) break;
-            printf("@E%d %lf %lf %lf %lf\n", curEdge->face, 
-            curEdge->start.x, curEdge->start.y, curEdge->end.x, curEdge->end.y);
-            curEdge = curEdge->prev;
-        } while (curEdge != face->edge);
+        if (cached) cacheClose(&cache);
     }
+    if (trace.size > 0) fwrite(trace.data, 1, trace.size, stdout);
+    check(d, err);
+    writeFile(out, &buf);
+
+    bufFree(&buf);
+    bufFree(&trace);
+    vorDestroy(d);
+    free(csv);
+    free(vertices);
+}
 
-    f = safeOpen(out, "w");
+void whatIf(char *towers, char *polygon, char *candidates, char *out) {
+    size_t towersLen, polygonLen, candidatesLen;
+    char *csv = readFile(towers, &towersLen),
+         *vertices = readFile(polygon, &polygonLen),
+         *sites = readFile(candidates, &candidatesLen);
+    diagram_t *d = newThreadedDiagram();
+    buffer_t buf = {0};
+
+    check(d, vorLoadPolygon(d, vertices, polygonLen));
+    check(d, vorAddTowers(d, csv, towersLen));
+    check(d, vorWhatIf(d, sites, candidatesLen, &buf));
+    writeFile(out, &buf);
+
+    bufFree(&buf);
+    vorDestroy(d);
+    free(csv);
+    free(vertices);
+    free(sites);
+}
+
+void render(char *towers, char *polygon, char *image, char *size) {
+    char *end;
+    long width = strtol(size, &end, 10);
+    if (*end != '\0' || width < 1 || width > RENDER_MAX_SIZE) {
+        printf("Invalid image width!\n");
+        exit(EXIT_FAILURE);
+    }
 
-    // Iterate through towers, find face and print
-    iterList(faceList, (void **) &face);
-    while (nextList(faceList)) {
-        if (face->tower == -1) continue;
-        tower_t *tower = getList(towerList, face->tower);
-        printTower(f, *tower, face->diameter);
+    // The format follows the image file's extension
+    size_t len = strlen(image);
+    bool png = len >= 4 && !strcmp(image + len - 4, ".png");
+    if (!png && (len < 4 || strcmp(image + len - 4, ".svg"))) {
+        printf("Image file must end in .svg or .png!\n");
+        exit(EXIT_FAILURE);
     }
-    fclose(f);
 
-    freeList(towerList);
-    freeList(faceList);
+    size_t towersLen, polygonLen;
+    char *csv = readFile(towers, &towersLen),
+         *vertices = readFile(polygon, &polygonLen);
+    diagram_t *d = newThreadedDiagram();
+    buffer_t buf = {0}, trace = {0};
+
+    // Warnings about rejected towers still go to stdout
+    vorTrace(d, &trace);
+    int err = vorLoadPolygon(d, vertices, polygonLen);
+    if (err == VOR_OK) err = vorAddTowers(d, csv, towersLen);
+    if (trace.size > 0) fwrite(trace.data, 1, trace.size, stdout);
+    check(d, err);
+
+    check(d, png ? vorRenderPng(d, (int) width, &buf) : vorRenderSvg(d, (int) width, &buf));
+    writeFile(image, &buf);
+
+    bufFree(&buf);
+    bufFree(&trace);
+    vorDestroy(d);
+    free(csv);
+    free(vertices);
 }
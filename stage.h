@@ -9,3 +9,11 @@ void stage2(char *, char *, char *);
 // Runs stage 3 or 4 with the 3 arguments as given
 // and a bool indicating whether to sort the result
 void stage34(char *, char *, char *, bool);
+
+// Builds the diagram of a tower file and polygon file, then writes how
+// inserting each tower of a candidate file on its own would change it
+void whatIf(char *, char *, char *, char *);
+
+// Builds the diagram of a tower file and polygon file, then draws it to an
+// image file ending in .svg or .png, the given number of pixels wide
+void render(char *, char *, char *, char *);
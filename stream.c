@@ -0,0 +1,1243 @@
+/*
+ *  Streaming mode: splits a tower file on disk into tiles, builds each
+ *  tile with a halo of the towers around it, and merges the rows of each
+ *  tile's core towers back into the order stage 3 or 4 would write them.
+ *  Only one tile is held in memory at a time.
+ *
+ *  Window mode builds a single tile, the window, with towers found
+ *  through an in-memory grid index instead of partitioning the file.
+ *
+ *  Delta mode keeps each tower's diameter and cell bounds from the last
+ *  run, and builds windows like window mode over only the cells that the
+ *  towers added, removed or moved since could have changed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "voronoi.h"
+
+// Temporary files open at once: tiles partitioned in one pass over the
+// tower file, and tile outputs waiting to be merged
+#define MAX_OPEN 256
+// Towers sampled to place the tile boundaries
+#define SAMPLE_SIZE 65536
+// Halo around a tile at first, in multiples of the mean tower spacing
+#define HALO_SPACINGS 3
+// Start of a delta mode state file
+#define STATE_MAGIC "VORDELT1"
+
+// Coordinates as read, before any rounding to coord_t
+typedef struct Point {
+    double x, y;
+} point_t;
+
+typedef struct Tile {
+    double left, right, bot, top;   // core, not including the right/top sides
+    double halo;
+    FILE *rows;     // "<row>,<tower row>" for the tile and its halo, where
+                    // halo towers have their row negated (minus one)
+    bool pending;   // still to be built
+} tile_t;
+
+typedef struct Grid {
+    double left, right, bot, top;   // extent of all the towers
+    long count;
+    int cols, rows;
+    tile_t *tiles;      // column by column
+    FILE **outs;        // "<diameter> <row>\t<output row>" in output order,
+    int outCount;       // from tiles built or earlier merges of them
+    char *header;
+    bool sorted;
+} grid_t;
+
+// A core tower of a tile, while its output is being ordered
+typedef struct Cell {
+    double diameter;
+    long row;
+    int tower;
+} cell_t;
+
+// A tile's output during the merge, and the row it is up to
+typedef struct Source {
+    FILE *f;
+    char *line, *text;
+    size_t cap;
+    cell_t key;
+} source_t;
+
+// Reads the next line without its line ending, false at the end of the file
+static bool readLine(FILE *f, char **line, size_t *cap) {
+    ssize_t n = getline(line, cap, f);
+    if (n < 0) return false;
+
+    while (n > 0 && ((*line)[n - 1] == '\n' || (*line)[n - 1] == '\r')) {
+        (*line)[--n] = '\0';
+    }
+    return true;
+}
+
+static bool isBlank(const char *line) {
+    while (isspace((unsigned char) *line)) line++;
+    return *line == '\0';
+}
+
+// Gets the coordinates from the last two fields of a tower row
+static bool rowPoint(const char *line, point_t *p) {
+    const char *comma = strrchr(line, ',');
+    if (comma == NULL) return false;
+    while (--comma >= line && *comma != ',');
+    return comma >= line && sscanf(comma + 1, "%lf,%lf", &p->x, &p->y) == 2;
+}
+
+static FILE * tempFile(void) {
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("temporary file");
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
+
+// Cheap deterministic generator for reservoir sampling
+static unsigned long nextRandom(unsigned long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int compareX(const void *a, const void *b) {
+    double x1 = ((const point_t *) a)->x, x2 = ((const point_t *) b)->x;
+    return (x1 > x2) - (x1 < x2);
+}
+
+static int compareY(const void *a, const void *b) {
+    double y1 = ((const point_t *) a)->y, y2 = ((const point_t *) b)->y;
+    return (y1 > y2) - (y1 < y2);
+}
+
+// Stage 4 order, where ties come out latest row first like compareDiameter
+static int compareCells(const void *a, const void *b) {
+    const cell_t *c1 = a, *c2 = b;
+    if (c1->diameter != c2->diameter) return c1->diameter < c2->diameter ? -1 : 1;
+    return (c1->row < c2->row) - (c1->row > c2->row);
+}
+
+// First pass: finds the extent of the towers and a uniform sample
+// of them, returning the size of the sample
+static long survey(grid_t *g, FILE *csv, point_t *sample) {
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned long state = 88172645463325252UL;
+
+    g->left = g->bot = HUGE_VAL;
+    g->right = g->top = -HUGE_VAL;
+    g->count = 0;
+
+    for (long n = 1; readLine(csv, &line, &cap); n++) {
+        if (isBlank(line)) continue;
+
+        point_t p;
+        if (!rowPoint(line, &p)) {
+            printf("tower line %ld has no coordinates, exiting...\n", n);
+            exit(EXIT_FAILURE);
+        }
+        g->left = min(g->left, p.x), g->right = max(g->right, p.x);
+        g->bot = min(g->bot, p.y), g->top = max(g->top, p.y);
+
+        // Every tower so far is equally likely to be in the sample
+        long slot = g->count++;
+        if (slot >= SAMPLE_SIZE) slot = nextRandom(&state) % g->count;
+        if (slot < SAMPLE_SIZE) sample[slot] = p;
+    }
+
+    free(line);
+    return min(g->count, SAMPLE_SIZE);
+}
+
+// Places tile boundaries so that each tile gets about the same number
+// of sampled towers: first into columns by x, then each column by y
+static void placeTiles(grid_t *g, point_t *sample, long sampled, long perTile) {
+    long tiles = max(1, (g->count + perTile - 1) / perTile);
+    g->cols = (int) ceil(sqrt((double) tiles));
+    g->rows = (int) ((tiles + g->cols - 1) / g->cols);
+    g->tiles = safeMalloc((size_t) g->cols * g->rows * sizeof(tile_t));
+
+    // Mean spacing between towers, which is about the size of a cell
+    double width = g->right - g->left, height = g->top - g->bot;
+    double spacing = width * height > 0 ? sqrt(width * height / g->count)
+                                        : max(width, height) / g->count;
+    double halo = spacing > 0 ? HALO_SPACINGS * spacing : 1;
+
+    qsort(sample, sampled, sizeof(point_t), compareX);
+    for (int c = 0; c < g->cols; c++) {
+        long from = sampled * c / g->cols, to = sampled * (c + 1) / g->cols;
+        double left = c == 0 ? g->left : sample[from].x,
+               right = c == g->cols - 1 ? g->right : sample[to].x;
+
+        qsort(sample + from, to - from, sizeof(point_t), compareY);
+        for (int r = 0; r < g->rows; r++) {
+            long lo = from + (to - from) * r / g->rows,
+                 hi = from + (to - from) * (r + 1) / g->rows;
+            g->tiles[c * g->rows + r] = (tile_t) {
+                .left = left, .right = right,
+                .bot = r == 0 ? g->bot : sample[lo].y,
+                .top = r == g->rows - 1 ? g->top : sample[hi].y,
+                .halo = halo,
+                .pending = true};
+        }
+        // Back in x order for the next column's boundary
+        qsort(sample + from, to - from, sizeof(point_t), compareX);
+    }
+}
+
+// The one tile whose core a point is in. The last column and row
+// also take points on their right and top sides
+static int coreTile(grid_t *g, point_t p) {
+    int c = 0, r = 0;
+    while (c < g->cols - 1 && p.x >= g->tiles[(c + 1) * g->rows].left) c++;
+    tile_t *column = &g->tiles[c * g->rows];
+    while (r < g->rows - 1 && p.y >= column[r + 1].bot) r++;
+    return c * g->rows + r;
+}
+
+static bool inHalo(tile_t *t, point_t p) {
+    return p.x >= t->left - t->halo && p.x <= t->right + t->halo &&
+           p.y >= t->bot - t->halo && p.y <= t->top + t->halo;
+}
+
+// Copies each tower into the files of a batch of tiles it is in or near
+static void partition(grid_t *g, FILE *csv, int *batch, int size) {
+    char *line = NULL;
+    size_t cap = 0;
+    long row = 0;
+
+    rewind(csv);
+    readLine(csv, &line, &cap);
+    while (readLine(csv, &line, &cap)) {
+        if (isBlank(line)) continue;
+
+        point_t p;
+        rowPoint(line, &p);
+        int core = coreTile(g, p);
+
+        for (int i = 0; i < size; i++) {
+            tile_t *t = &g->tiles[batch[i]];
+            if (inHalo(t, p)) {
+                fprintf(t->rows, "%ld,%s\n", batch[i] == core ? row : -row - 1, line);
+            }
+        }
+        row++;
+    }
+    free(line);
+}
+
+// Whether no tower outside a tile's halo could cut into a cell. That is,
+// whether the circle through each vertex of the cell centred on its tower
+// is inside the halo, or goes past the side of every tower there is
+static bool settled(grid_t *g, tile_t *t, face_t *face) {
+    edge_t *curEdge = face->edge;
+    do {
+        calc_t x = toCalc(curEdge->start.x), y = toCalc(curEdge->start.y),
+               r = norm(getVec(curEdge->start, face->centre));
+
+        if ((x - r < t->left - t->halo && t->left - t->halo > g->left) ||
+                (x + r > t->right + t->halo && t->right + t->halo < g->right) ||
+                (y - r < t->bot - t->halo && t->bot - t->halo > g->bot) ||
+                (y + r > t->top + t->halo && t->top + t->halo < g->top)) {
+            return false;
+        }
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    return true;
+}
+
+// Reads the next row of a tile's output, false once it has run out
+static bool nextRow(source_t *s) {
+    if (!readLine(s->f, &s->line, &s->cap)) return false;
+
+    char *end;
+    s->key.diameter = strtod(s->line, &end);
+    s->key.row = strtol(end, &end, 10);
+    s->text = end + 1;
+    return true;
+}
+
+// Whether source a should be written before source b
+static bool before(grid_t *g, source_t *a, source_t *b) {
+    return g->sorted ? compareCells(&a->key, &b->key) < 0 : a->key.row < b->key.row;
+}
+
+static void siftDown(grid_t *g, source_t **heap, int size, int i) {
+    while (true) {
+        int first = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < size && before(g, heap[l], heap[first])) first = l;
+        if (r < size && before(g, heap[r], heap[first])) first = r;
+        if (first == i) return;
+
+        source_t *tmp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = tmp;
+        i = first;
+    }
+}
+
+// Merges outputs, each already in order, into one file. Keeps the
+// keys in front of each row if the result is to be merged again
+static bool mergeFiles(grid_t *g, FILE **files, int count, FILE *out, bool keys) {
+    int size = 0;
+    source_t *sources = safeMalloc(max(count, 1) * sizeof(source_t));
+    source_t **heap = safeMalloc(max(count, 1) * sizeof(source_t *));
+
+    for (int i = 0; i < count; i++) {
+        sources[i] = (source_t) {.f = files[i]};
+        if (nextRow(&sources[i])) heap[size++] = &sources[i];
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) siftDown(g, heap, size, i);
+
+    while (size > 0) {
+        fprintf(out, "%s\n", keys ? heap[0]->line : heap[0]->text);
+        if (!nextRow(heap[0])) heap[0] = heap[--size];
+        siftDown(g, heap, size, 0);
+    }
+    bool ok = !ferror(out);
+
+    for (int i = 0; i < count; i++) free(sources[i].line);
+    free(sources);
+    free(heap);
+    return ok;
+}
+
+// Keeps a tile's output for the final merge. Once MAX_OPEN outputs are
+// open they are merged into one, so any number of tiles can be merged
+static bool addOutput(grid_t *g, FILE *f) {
+    bool ok = true;
+    if (g->outCount == MAX_OPEN) {
+        FILE *merged = tempFile();
+        ok = mergeFiles(g, g->outs, g->outCount, merged, true);
+        for (int i = 0; i < g->outCount; i++) fclose(g->outs[i]);
+        rewind(merged);
+        g->outs[0] = merged;
+        g->outCount = 1;
+    }
+    g->outs[g->outCount++] = f;
+    return ok;
+}
+
+// Builds a tile and writes out its core towers. Returns false if the
+// engine failed, or else sets whether the halo was wide enough
+static bool buildTile(grid_t *g, tile_t *t, diagram_t *d, char *polygon,
+                      size_t polygonLen, bool *done) {
+    buffer_t csv = {0}, out = {0};
+    long *rows = NULL, count = 0, cap = 0, cores = 0;
+    char *line = NULL;
+    size_t lineCap = 0;
+
+    // Split the row numbers back off to get a tower file
+    bufPrintf(&csv, "%s\n", g->header);
+    rewind(t->rows);
+    while (readLine(t->rows, &line, &lineCap)) {
+        char *comma = strchr(line, ',');
+        if (count == cap) {
+            cap = max(2 * cap, 1024);
+            rows = safeRealloc(rows, cap * sizeof(long));
+        }
+        rows[count] = strtol(line, NULL, 10);
+        cores += rows[count++] >= 0;
+        bufPrintf(&csv, "%s\n", comma + 1);
+    }
+    free(line);
+
+    *done = true;
+    bool ok = true;
+    if (cores > 0) {
+        vorReset(d);
+        if (csv.failed || vorLoadPolygon(d, polygon, polygonLen) != VOR_OK ||
+                vorAddTowers(d, csv.data, csv.size) != VOR_OK) {
+            printf("%s, exiting...\n", csv.failed ? "out of memory" : vorError(d));
+            ok = false;
+        }
+    }
+
+    cell_t *cells = safeMalloc(max(cores, 1) * sizeof(cell_t));
+    long n = 0;
+    for (face_t *face = beginFaceVec(&d->faces); ok && cores > 0 &&
+            face != endFaceVec(&d->faces); face++) {
+        if (face->tower == -1 || rows[face->tower] < 0) continue;
+
+        if (!settled(g, t, face)) {
+            *done = false;
+            break;
+        }
+        cells[n++] = (cell_t) {.diameter = diameter(face),
+                               .row = rows[face->tower],
+                               .tower = face->tower};
+    }
+
+    if (ok && *done) {
+        // Faces are already in row order for stage 3
+        if (g->sorted) qsort(cells, n, sizeof(cell_t), compareCells);
+
+        for (long i = 0; i < n; i++) {
+            bufPrintf(&out, "%a %ld\t", cells[i].diameter, cells[i].row);
+            printTower(&out, &d->towers, cells[i].tower, cells[i].diameter);
+        }
+        FILE *f = tempFile();
+        ok = !out.failed && fwrite(out.data, 1, out.size, f) == out.size;
+        rewind(f);
+        ok = addOutput(g, f) && ok;
+        if (!ok) printf("cannot write tile output, exiting...\n");
+    }
+
+    free(cells);
+    free(rows);
+    bufFree(&csv);
+    bufFree(&out);
+    return ok;
+}
+
+// Merges the tiles' outputs into the output file
+static bool merge(grid_t *g, const char *path) {
+    FILE *out = safeOpen(path, "w");
+    bool ok = mergeFiles(g, g->outs, g->outCount, out, false);
+    ok &= fclose(out) == 0;
+    return ok;
+}
+
+bool streamTowers(char *towers, char *polygon, char *out, char *perTile, bool sorted) {
+    char *end;
+    long tileSize = strtol(perTile, &end, 10);
+    if (*end != '\0' || tileSize < 1) {
+        printf("Invalid tile size!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t polygonLen;
+    char *vertices = readFile(polygon, &polygonLen);
+    FILE *csv = safeOpen(towers, "r");
+
+    grid_t *g = safeMalloc(sizeof(grid_t));
+    *g = (grid_t) {.sorted = sorted};
+    size_t cap = 0;
+    if (!readLine(csv, &g->header, &cap)) {
+        printf("Wrong Header!, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    point_t *sample = safeMalloc(SAMPLE_SIZE * sizeof(point_t));
+    long sampled = survey(g, csv, sample);
+    if (g->count == 0) sample[sampled++] = (point_t) {0};
+    placeTiles(g, sample, sampled, tileSize);
+    free(sample);
+
+    diagram_t *d = vorCreate();
+    if (d == NULL) {
+        printf("malloc failed, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Pending tiles are partitioned MAX_OPEN at a time. Tiles whose halo
+    // turns out too narrow go round again with twice the halo
+    int tiles = g->cols * g->rows, pending = tiles, rebuilt = 0;
+    int *batch = safeMalloc(min(tiles, MAX_OPEN) * sizeof(int));
+    g->outs = safeMalloc(MAX_OPEN * sizeof(FILE *));
+    bool ok = true;
+    while (ok && pending > 0) {
+        int size = 0;
+        for (int i = 0; i < tiles && size < MAX_OPEN; i++) {
+            if (!g->tiles[i].pending) continue;
+            g->tiles[i].rows = tempFile();
+            batch[size++] = i;
+        }
+        partition(g, csv, batch, size);
+
+        for (int i = 0; ok && i < size; i++) {
+            tile_t *t = &g->tiles[batch[i]];
+
+            bool done;
+            ok = buildTile(g, t, d, vertices, polygonLen, &done);
+            fclose(t->rows);
+            t->rows = NULL;
+            if (done) {
+                t->pending = false;
+                pending--;
+            } else {
+                t->halo *= 2;
+                rebuilt++;
+            }
+        }
+    }
+
+    if (ok) {
+        ok = merge(g, out);
+        if (!ok) printf("cannot write %s\n", out);
+        printf("%ld towers in %d tiles, %d tile builds repeated with a wider halo\n",
+               g->count, tiles, rebuilt);
+    }
+
+    for (int i = 0; i < tiles; i++) {
+        if (g->tiles[i].rows != NULL) fclose(g->tiles[i].rows);
+    }
+    for (int i = 0; i < g->outCount; i++) fclose(g->outs[i]);
+    vorDestroy(d);
+    fclose(csv);
+    free(batch);
+    free(g->outs);
+    free(g->tiles);
+    free(g->header);
+    free(g);
+    free(vertices);
+    return ok;
+}
+
+// A tower of the whole file in window mode, with where its row is
+typedef struct Row {
+    point_t p;
+    const char *text;
+    size_t len;
+} row_t;
+
+// Rows bucketed into the squares of a uniform grid over the towers'
+// extent, so the rows near a window are found without visiting the rest
+typedef struct Index {
+    double width, height;   // of a bucket
+    long cols, rows;
+    long *start;            // bucket b holds order[start[b]] up to order[start[b + 1]]
+    long *order;            // row numbers, increasing within each bucket
+} index_t;
+
+// Gets the coordinates from the last two fields of a row that isn't
+// NUL-terminated, but is followed by a line ending or the end of the file
+static bool linePoint(const char *line, size_t len, point_t *p) {
+    const char *last = NULL, *prev = NULL;
+    for (const char *c = line; c < line + len; c++) {
+        if (*c == ',') prev = last, last = c;
+    }
+    if (prev == NULL) return false;
+
+    char *end;
+    p->x = strtod(prev + 1, &end);
+    if (end != last) return false;
+    p->y = strtod(last + 1, &end);
+    return end > last + 1;
+}
+
+static long bucketCol(index_t *index, grid_t *g, double x) {
+    long c = (long) floor((x - g->left) / index->width);
+    return max(0, min(c, index->cols - 1));
+}
+
+static long bucketRow(index_t *index, grid_t *g, double y) {
+    long r = (long) floor((y - g->bot) / index->height);
+    return max(0, min(r, index->rows - 1));
+}
+
+// Buckets every row by counting sort, so each bucket keeps row order
+static void buildIndex(index_t *index, grid_t *g, row_t *rows) {
+    long side = max(1, min((long) ceil(sqrt((double) g->count)), 4096));
+    index->cols = index->rows = side;
+    index->width = g->right > g->left ? (g->right - g->left) / side : 1;
+    index->height = g->top > g->bot ? (g->top - g->bot) / side : 1;
+    index->start = safeMalloc((side * side + 1) * sizeof(long));
+    index->order = safeMalloc(max(g->count, 1) * sizeof(long));
+
+    long *bucket = safeMalloc(max(g->count, 1) * sizeof(long));
+    memset(index->start, 0, (side * side + 1) * sizeof(long));
+    for (long i = 0; i < g->count; i++) {
+        bucket[i] = bucketCol(index, g, rows[i].p.x) * side + bucketRow(index, g, rows[i].p.y);
+        index->start[bucket[i] + 1]++;
+    }
+    for (long b = 0; b < side * side; b++) index->start[b + 1] += index->start[b];
+
+    long *next = safeMalloc(side * side * sizeof(long));
+    memcpy(next, index->start, side * side * sizeof(long));
+    for (long i = 0; i < g->count; i++) index->order[next[bucket[i]]++] = i;
+    free(next);
+    free(bucket);
+}
+
+static int compareRows(const void *a, const void *b) {
+    long r1 = *(const long *) a, r2 = *(const long *) b;
+    return (r1 > r2) - (r1 < r2);
+}
+
+// Finds the rows in a tile's halo, in row order. Returns how many
+static long findRows(index_t *index, grid_t *g, row_t *rows, tile_t *t, long **found) {
+    long count = 0, cap = 0;
+    long c1 = bucketCol(index, g, t->left - t->halo), c2 = bucketCol(index, g, t->right + t->halo),
+         r1 = bucketRow(index, g, t->bot - t->halo), r2 = bucketRow(index, g, t->top + t->halo);
+
+    for (long c = c1; c <= c2; c++) {
+        for (long r = r1; r <= r2; r++) {
+            long b = c * index->rows + r;
+            for (long i = index->start[b]; i < index->start[b + 1]; i++) {
+                long row = index->order[i];
+                if (!inHalo(t, rows[row].p)) continue;
+                if (count == cap) {
+                    cap = max(2 * cap, 1024);
+                    *found = safeRealloc(*found, cap * sizeof(long));
+                }
+                (*found)[count++] = row;
+            }
+        }
+    }
+
+    qsort(*found, count, sizeof(long), compareRows);
+    return count;
+}
+
+// Whether a segment passes through a tile's core (Liang-Barsky clipping)
+static bool segmentInCore(tile_t *t, double x1, double y1, double x2, double y2) {
+    double dx = x2 - x1, dy = y2 - y1, from = 0, to = 1;
+    double p[4] = {-dx, dx, -dy, dy},
+           q[4] = {x1 - t->left, t->right - x1, y1 - t->bot, t->top - y1};
+
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            if (q[i] < 0) return false;
+        } else if (p[i] < 0) {
+            from = max(from, q[i] / p[i]);
+        } else {
+            to = min(to, q[i] / p[i]);
+        }
+    }
+    return from <= to;
+}
+
+// Whether a cell overlaps a tile's core: an edge passes through it, or
+// failing that the core is inside the cell (checked at one corner)
+static bool overlapsCore(tile_t *t, face_t *face) {
+    edge_t *curEdge = face->edge;
+    bool inside = false;
+    do {
+        double x1 = toCalc(curEdge->start.x), y1 = toCalc(curEdge->start.y),
+               x2 = toCalc(curEdge->end.x), y2 = toCalc(curEdge->end.y);
+        if (segmentInCore(t, x1, y1, x2, y2)) return true;
+
+        if ((y1 > t->bot) != (y2 > t->bot) && 
+                t->left < x1 + (t->bot - y1) * (x2 - x1) / (y2 - y1)) {
+            inside = !inside;
+        }
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+
+    return inside;
+}
+
+// Builds the towers in the window's halo and gathers the cells that
+// overlap the window. Returns false if the engine failed, or else sets
+// whether the halo was wide enough and whether there were any cells
+static bool buildWindow(grid_t *g, tile_t *w, row_t *rows, long *found, long count,
+                        diagram_t *d, char *polygon, size_t polygonLen,
+                        cell_t *cells, long *n, bool *done, bool *empty) {
+    buffer_t csv = {0};
+    bufPrintf(&csv, "%s\n", g->header);
+    for (long i = 0; i < count; i++) {
+        bufWrite(&csv, rows[found[i]].text, rows[found[i]].len);
+        bufWrite(&csv, "\n", 1);
+    }
+
+    *n = 0;
+    *done = true;
+    *empty = true;
+    bool ok = true;
+    if (count > 0) {
+        vorReset(d);
+        if (csv.failed || vorLoadPolygon(d, polygon, polygonLen) != VOR_OK ||
+                vorAddTowers(d, csv.data, csv.size) != VOR_OK) {
+            printf("%s, exiting...\n", csv.failed ? "out of memory" : vorError(d));
+            ok = false;
+        }
+    }
+
+    // Cells of the halo's towers cover the polygon, so once those over
+    // the window are settled no other tower's cell can reach into it
+    for (face_t *face = beginFaceVec(&d->faces); ok && count > 0 &&
+            face != endFaceVec(&d->faces); face++) {
+        if (face->tower == -1) continue;
+        *empty = false;
+        if (!overlapsCore(w, face)) continue;
+
+        if (!settled(g, w, face)) {
+            *done = false;
+            break;
+        }
+        cells[(*n)++] = (cell_t) {.diameter = diameter(face),
+                                  .row = found[face->tower],
+                                  .tower = face->tower};
+    }
+
+    bufFree(&csv);
+    return ok;
+}
+
+bool windowTowers(char *towers, char *polygon, char *out, char **window, bool sorted) {
+    double bounds[4];
+    for (int i = 0; i < 4; i++) {
+        char *end;
+        bounds[i] = strtod(window[i], &end);
+        if (*end != '\0' || end == window[i] || !isfinite(bounds[i])) {
+            printf("Invalid window!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (bounds[0] > bounds[2] || bounds[1] > bounds[3]) {
+        printf("Invalid window!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t csvLen, polygonLen;
+    char *csv = readFile(towers, &csvLen),
+         *vertices = readFile(polygon, &polygonLen);
+    const char *cur = csv, *end = csv + csvLen, *line;
+    size_t lineLen;
+
+    grid_t *g = safeMalloc(sizeof(grid_t));
+    *g = (grid_t) {.sorted = sorted, .left = HUGE_VAL, .right = -HUGE_VAL,
+                   .bot = HUGE_VAL, .top = -HUGE_VAL};
+    if (!scanLine(&cur, end, &line, &lineLen)) {
+        printf("Wrong Header!, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    while (lineLen > 0 && line[lineLen - 1] == '\r') lineLen--;
+    g->header = strndup(line, lineLen);
+
+    // Only the coordinates and place of each row are kept at first
+    row_t *rows = NULL;
+    long cap = 0;
+    for (long n = 1; scanLine(&cur, end, &line, &lineLen); n++) {
+        while (lineLen > 0 && line[lineLen - 1] == '\r') lineLen--;
+        size_t blank = 0;
+        while (blank < lineLen && isspace((unsigned char) line[blank])) blank++;
+        if (blank == lineLen) continue;
+
+        point_t p;
+        if (!linePoint(line, lineLen, &p)) {
+            printf("tower line %ld has no coordinates, exiting...\n", n);
+            exit(EXIT_FAILURE);
+        }
+        g->left = min(g->left, p.x), g->right = max(g->right, p.x);
+        g->bot = min(g->bot, p.y), g->top = max(g->top, p.y);
+
+        if (g->count == cap) {
+            cap = max(2 * cap, 1024);
+            rows = safeRealloc(rows, cap * sizeof(row_t));
+        }
+        rows[g->count++] = (row_t) {p, line, lineLen};
+    }
+
+    index_t index;
+    buildIndex(&index, g, rows);
+
+    // The window is a tile, starting with the same halo a tile would have
+    double width = g->right - g->left, height = g->top - g->bot;
+    double spacing = width * height > 0 ? sqrt(width * height / g->count)
+                                        : max(width, height) / max(g->count, 1);
+    tile_t box = {.left = bounds[0], .bot = bounds[1], .right = bounds[2], .top = bounds[3],
+                     .halo = spacing > 0 ? HALO_SPACINGS * spacing : 1};
+    tile_t *w = &box;
+
+    diagram_t *d = vorCreate();
+    if (d == NULL) {
+        printf("malloc failed, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long *found = NULL, count = 0, n = 0;
+    cell_t *cells = NULL;
+    int rebuilt = 0;
+    bool ok = true, done = false, empty;
+    while (ok && !done) {
+        count = findRows(&index, g, rows, w, &found);
+        cells = safeRealloc(cells, max(count, 1) * sizeof(cell_t));
+        ok = buildWindow(g, w, rows, found, count, d, vertices, polygonLen, 
+                         cells, &n, &done, &empty);
+
+        // Without any cells near it, the window could still be in a far one
+        bool everything = w->left - w->halo <= g->left && w->right + w->halo >= g->right &&
+                          w->bot - w->halo <= g->bot && w->top + w->halo >= g->top;
+        if (empty && !everything) done = false;
+        if (ok && !done) {
+            w->halo *= 2;
+            rebuilt++;
+        }
+    }
+
+    if (ok) {
+        // Faces are already in row order for stage 3
+        if (sorted) qsort(cells, n, sizeof(cell_t), compareCells);
+
+        buffer_t buf = {0};
+        for (long i = 0; i < n; i++) {
+            printTower(&buf, &d->towers, cells[i].tower, cells[i].diameter);
+        }
+        FILE *f = safeOpen(out, "w");
+        if (buf.size > 0) fwrite(buf.data, 1, buf.size, f);
+        ok = !buf.failed && !ferror(f);
+        ok &= fclose(f) == 0;
+        if (!ok) printf("cannot write %s\n", out);
+        bufFree(&buf);
+
+        printf("%ld cells from %ld of %ld towers, %d builds repeated with a wider halo\n",
+               n, count, g->count, rebuilt);
+    }
+
+    vorDestroy(d);
+    free(cells);
+    free(found);
+    free(index.start);
+    free(index.order);
+    free(rows);
+    free(g->header);
+    free(g);
+    free(csv);
+    free(vertices);
+    return ok;
+}
+
+// A tower's result as kept between delta runs, with the bounding box of
+// its cell. Rejected towers have a NaN diameter
+typedef struct Saved {
+    double x, y, diameter;
+    double left, bot, right, top;
+    uint64_t id;    // offset of the id in the state's text
+} saved_t;
+
+// A delta run's state file, tied to the polygon it was built in
+typedef struct State {
+    uint64_t polygon, count, textSize;
+    saved_t *saved;
+    char *text;
+} state_t;
+
+// The kept towers of a delta run bucketed like window mode's rows, and
+// what is needed to build a window around any of them
+typedef struct Delta {
+    grid_t *g;
+    index_t index;
+    row_t *rows;
+    long *tower;        // tower of each row
+    diagram_t *d;
+    const char *polygon;
+    size_t polygonLen;
+    double spacing;
+    long *found;
+    double *xy;
+    cell_t *cells;
+    saved_t *now;       // result of each tower
+    long windows, rebuilt;
+} delta_t;
+
+// Hashes the polygon as read, and which coordinate build read it
+static uint64_t polygonHash(diagram_t *d) {
+    const coordvec_t *vertices = &d->boundary.vertices;
+    real_t unit = toReal(1.0);
+    uint64_t seed = hashBytes(&unit, sizeof(unit), sizeof(real_t));
+    return hashBytes(vertices->arr, vertices->size * sizeof(coord_t), seed);
+}
+
+// Reads a state file, false if there is none or it doesn't fit the polygon
+static bool loadState(const char *path, uint64_t polygon, state_t *s) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return false;
+
+    char magic[sizeof(STATE_MAGIC) - 1];
+    *s = (state_t) {0};
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+              !memcmp(magic, STATE_MAGIC, sizeof(magic)) &&
+              fread(&s->polygon, sizeof(s->polygon), 1, f) == 1 &&
+              fread(&s->count, sizeof(s->count), 1, f) == 1 &&
+              fread(&s->textSize, sizeof(s->textSize), 1, f) == 1 &&
+              s->polygon == polygon && s->count < ((uint64_t) 1 << 40) &&
+              s->textSize < ((uint64_t) 1 << 40);
+    if (ok) {
+        s->saved = safeMalloc(max(s->count, 1) * sizeof(saved_t));
+        s->text = safeMalloc(max(s->textSize, 1));
+        ok = fread(s->saved, sizeof(saved_t), s->count, f) == s->count &&
+             fread(s->text, 1, s->textSize, f) == s->textSize &&
+             (s->textSize == 0 || s->text[s->textSize - 1] == '\0');
+        for (uint64_t i = 0; ok && i < s->count; i++) ok = s->saved[i].id < s->textSize;
+    }
+    fclose(f);
+
+    if (!ok) {
+        free(s->saved);
+        free(s->text);
+        *s = (state_t) {0};
+    }
+    return ok;
+}
+
+// Writes the results of every tower under another name first, so a run
+// that fails part way leaves the last state as it was
+static bool storeState(const char *path, uint64_t polygon, const towers_t *t,
+                       saved_t *now) {
+    buffer_t text = {0};
+    for (long i = 0; i < t->count; i++) {
+        now[i].id = text.size;
+        const char *id = towerId(t, i);
+        bufWrite(&text, id, strlen(id) + 1);
+    }
+
+    size_t len = strlen(path) + 5;
+    char *temp = safeMalloc(len);
+    snprintf(temp, len, "%s.tmp", path);
+    FILE *f = fopen(temp, "wb");
+    uint64_t count = t->count, textSize = text.size;
+    bool ok = f != NULL && !text.failed &&
+              fwrite(STATE_MAGIC, sizeof(STATE_MAGIC) - 1, 1, f) == 1 &&
+              fwrite(&polygon, sizeof(polygon), 1, f) == 1 &&
+              fwrite(&count, sizeof(count), 1, f) == 1 &&
+              fwrite(&textSize, sizeof(textSize), 1, f) == 1 &&
+              fwrite(now, sizeof(saved_t), t->count, f) == (size_t) t->count &&
+              fwrite(text.data, 1, text.size, f) == text.size;
+    if (f != NULL) ok &= fclose(f) == 0;
+    if (!ok || rename(temp, path) != 0) {
+        if (f != NULL) remove(temp);
+        printf("cannot write %s\n", path);
+        ok = false;
+    }
+
+    free(temp);
+    bufFree(&text);
+    return ok;
+}
+
+// Sets a result's bounding box to its cell's
+static void cellBox(face_t *face, saved_t *s) {
+    edge_t *curEdge = face->edge;
+    s->left = s->bot = HUGE_VAL;
+    s->right = s->top = -HUGE_VAL;
+    do {
+        double x = toCalc(curEdge->start.x), y = toCalc(curEdge->start.y);
+        s->left = min(s->left, x), s->right = max(s->right, x);
+        s->bot = min(s->bot, y), s->top = max(s->top, y);
+        curEdge = curEdge->next;
+    } while (curEdge != face->edge);
+}
+
+// Builds the kept towers around a box like a window, widening its halo
+// until the cells overlapping it are settled, and sets their results.
+// Returns false if the engine failed on the towers around it
+static bool rebuildBox(delta_t *x, double left, double bot, double right, double top) {
+    grid_t *g = x->g;
+    tile_t box = {.left = left, .bot = bot, .right = right, .top = top,
+                     .halo = x->spacing > 0 ? HALO_SPACINGS * x->spacing : 1};
+    tile_t *w = &box;
+    x->windows++;
+
+    long count, n = 0;
+    bool done = false;
+    while (!done) {
+        count = findRows(&x->index, g, x->rows, w, &x->found);
+        x->xy = safeRealloc(x->xy, max(count, 1) * 2 * sizeof(double));
+        x->cells = safeRealloc(x->cells, max(count, 1) * sizeof(cell_t));
+        for (long i = 0; i < count; i++) {
+            x->xy[2 * i] = x->rows[x->found[i]].p.x;
+            x->xy[2 * i + 1] = x->rows[x->found[i]].p.y;
+        }
+
+        vorReset(x->d);
+        if (vorLoadPolygon(x->d, x->polygon, x->polygonLen) != VOR_OK ||
+                (count > 0 && vorAddPoints(x->d, x->xy, NULL, count) != VOR_OK)) {
+            printf("%s, rebuilding everything\n", vorError(x->d));
+            return false;
+        }
+
+        // Only kept towers are built, so none are rejected here
+        n = 0;
+        done = true;
+        bool empty = true;
+        for (face_t *face = beginFaceVec(&x->d->faces); face != endFaceVec(&x->d->faces);
+                face++) {
+            if (face->tower == -1) continue;
+            empty = false;
+            if (!overlapsCore(w, face)) continue;
+
+            if (!settled(g, w, face)) {
+                done = false;
+                break;
+            }
+            x->cells[n++] = (cell_t) {.diameter = diameter(face),
+                                      .row = x->found[face->tower],
+                                      .tower = face->tower};
+        }
+
+        bool everything = w->left - w->halo <= g->left && w->right + w->halo >= g->right &&
+                          w->bot - w->halo <= g->bot && w->top + w->halo >= g->top;
+        if (empty && !everything) done = false;
+        if (!done) {
+            w->halo *= 2;
+            x->rebuilt++;
+        }
+    }
+
+    for (long i = 0; i < n; i++) {
+        saved_t *s = &x->now[x->tower[x->cells[i].row]];
+        s->diameter = x->cells[i].diameter;
+        cellBox(getFaceVec(&x->d->faces, x->d->towers.face[x->cells[i].tower]), s);
+    }
+    return true;
+}
+
+// Adds a box, widened by the tolerance for comparing coordinates as the
+// same vertex may come out slightly differently from another build
+static void addBox(saved_t **boxes, long *count, long *cap, const saved_t *s) {
+    if (*count == *cap) {
+        *cap = max(2 * *cap, 64);
+        *boxes = safeRealloc(*boxes, *cap * sizeof(saved_t));
+    }
+    (*boxes)[(*count)++] = (saved_t) {.left = s->left - PRECISION, .bot = s->bot - PRECISION,
+                                      .right = s->right + PRECISION, .top = s->top + PRECISION};
+}
+
+// Finds a tower by id in an open addressing table of tower numbers
+static long *findId(long *slots, long mask, const towers_t *t, const char *id) {
+    uint64_t h = hashBytes(id, strlen(id), 0);
+    long *slot = &slots[h & mask];
+    while (*slot != -1 && strcmp(towerId(t, *slot), id)) slot = &slots[++h & mask];
+    return slot;
+}
+
+// Applies the changes between the saved towers and the new ones. Returns
+// false if the engine failed on the whole tower file, or else sets whether
+// the state could be used. A window the engine fails on is left to a full
+// build, which may still succeed as the towers go in another order
+static bool applyDelta(diagram_t *full, state_t *s, const char *polygon, size_t polygonLen,
+                       saved_t *now, bool *usable, buffer_t *report) {
+    towers_t *t = &full->towers;
+    bool *keep = safeMalloc(max(t->count, 1) * sizeof(bool));
+    bool ok = vorCheckTowers(full, keep) == VOR_OK;
+    if (!ok) printf("%s, exiting...\n", vorError(full));
+
+    // Ids of the new towers, which have to be unique to match them up
+    long cap = 16;
+    while (cap < 2 * t->count) cap *= 2;
+    long *slots = safeMalloc(cap * sizeof(long)), *match = NULL;
+    for (long i = 0; i < cap; i++) slots[i] = -1;
+    *usable = ok;
+    for (long i = 0; *usable && i < t->count; i++) {
+        long *slot = findId(slots, cap - 1, t, towerId(t, i));
+        if (*slot != -1) {
+            bufPrintf(report, "Tower id %s is not unique, rebuilding everything\n",
+                      towerId(t, i));
+            *usable = false;
+        }
+        *slot = i;
+    }
+
+    // Which saved tower each new one was, or -1 if it is new
+    if (*usable) {
+        match = safeMalloc(max(t->count, 1) * sizeof(long));
+        for (long i = 0; i < t->count; i++) match[i] = -1;
+        for (uint64_t j = 0; *usable && j < s->count; j++) {
+            long i = *findId(slots, cap - 1, t, s->text + s->saved[j].id);
+            if (i == -1) continue;
+            if (match[i] != -1) {
+                bufPrintf(report, "Saved tower id %s is not unique, rebuilding everything\n",
+                          towerId(t, i));
+                *usable = false;
+            }
+            match[i] = j;
+        }
+    }
+
+    delta_t x = {.polygon = polygon, .polygonLen = polygonLen, .now = now};
+    saved_t *boxes = NULL;
+    long boxCount = 0, boxCap = 0, added = 0, removed = 0, moved = 0, kept = 0;
+    if (*usable) {
+        x.g = safeMalloc(sizeof(grid_t));
+        *x.g = (grid_t) {.left = HUGE_VAL, .right = -HUGE_VAL, .bot = HUGE_VAL, .top = -HUGE_VAL};
+        x.rows = safeMalloc(max(t->count, 1) * sizeof(row_t));
+        x.tower = safeMalloc(max(t->count, 1) * sizeof(long));
+        for (long i = 0; i < t->count; i++) {
+            now[i] = (saved_t) {.x = toCalc(t->coord[i].x), .y = toCalc(t->coord[i].y),
+                                .diameter = NAN};
+            if (!keep[i]) continue;
+            grid_t *g = x.g;
+            point_t p = {now[i].x, now[i].y};
+            g->left = min(g->left, p.x), g->right = max(g->right, p.x);
+            g->bot = min(g->bot, p.y), g->top = max(g->top, p.y);
+            x.tower[g->count] = i;
+            x.rows[g->count++] = (row_t) {.p = p};
+        }
+        buildIndex(&x.index, x.g, x.rows);
+        double width = x.g->right - x.g->left, height = x.g->top - x.g->bot;
+        x.spacing = width * height > 0 ? sqrt(width * height / x.g->count)
+                                       : max(width, height) / max(x.g->count, 1);
+
+        // Cells that change are all within the old cells of the towers
+        // taken away and the new cells of those put in, as are the cells
+        // of the towers they border
+        bool *seen = safeMalloc(max(s->count, 1) * sizeof(bool));
+        memset(seen, 0, max(s->count, 1) * sizeof(bool));
+        for (long i = 0; i < t->count; i++) {
+            saved_t *old = match[i] == -1 ? NULL : &s->saved[match[i]];
+            bool was = old != NULL && !isnan(old->diameter);
+            if (old != NULL) seen[match[i]] = true;
+            kept += keep[i];
+
+            if (was && keep[i] && old->x == now[i].x && old->y == now[i].y) {
+                now[i].diameter = old->diameter;
+                now[i].left = old->left, now[i].bot = old->bot;
+                now[i].right = old->right, now[i].top = old->top;
+                continue;
+            }
+            if (was) addBox(&boxes, &boxCount, &boxCap, old);
+            if (was && keep[i]) moved++;
+            else if (was) removed++;
+            else if (keep[i]) added++;
+        }
+        for (uint64_t j = 0; j < s->count; j++) {
+            if (!seen[j] && !isnan(s->saved[j].diameter)) {
+                addBox(&boxes, &boxCount, &boxCap, &s->saved[j]);
+                removed++;
+            }
+        }
+        free(seen);
+
+        x.d = vorCreate();
+        if (x.d == NULL) {
+            printf("malloc failed, exiting...\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // A new cell is found from its tower before the cells around it
+        for (long i = 0; *usable && i < t->count; i++) {
+            saved_t *old = match[i] == -1 ? NULL : &s->saved[match[i]];
+            bool was = old != NULL && !isnan(old->diameter);
+            if (!keep[i] || (was && old->x == now[i].x && old->y == now[i].y)) continue;
+
+            *usable = rebuildBox(&x, now[i].x, now[i].y, now[i].x, now[i].y);
+            if (*usable) addBox(&boxes, &boxCount, &boxCap, &now[i]);
+        }
+        for (long i = 0; *usable && x.g->count > 0 && i < boxCount; i++) {
+            *usable = rebuildBox(&x, boxes[i].left, boxes[i].bot, boxes[i].right, boxes[i].top);
+        }
+
+        if (*usable) {
+            bufPrintf(report, "%ld towers added, %ld removed and %ld moved, %ld windows rebuilt "
+                   "(%ld repeated with a wider halo) for %ld cells\n",
+                   added, removed, moved, x.windows, x.rebuilt, kept);
+        }
+
+        vorDestroy(x.d);
+        free(x.index.start);
+        free(x.index.order);
+        free(x.rows);
+        free(x.tower);
+        free(x.g);
+    }
+
+    free(x.found);
+    free(x.xy);
+    free(x.cells);
+    free(boxes);
+    free(match);
+    free(slots);
+    free(keep);
+    return ok;
+}
+
+// Builds every tower, setting each one's result and writing the output
+static bool fullBuild(diagram_t *full, buffer_t *out, bool sorted, saved_t *now,
+                      buffer_t *report) {
+    towers_t *t = &full->towers;
+
+    // Traced like stage 3/4, with its warnings and @W/@E lines
+    vorThreads(full, sysconf(_SC_NPROCESSORS_ONLN));
+    bool ok = vorBuild34(full, out, sorted) == VOR_OK;
+    if (!ok) printf("%s, exiting...\n", vorError(full));
+
+    for (long i = 0; ok && i < t->count; i++) {
+        now[i] = (saved_t) {.x = toCalc(t->coord[i].x), .y = toCalc(t->coord[i].y),
+                            .diameter = NAN};
+        if (t->face[i] == -1) continue;
+        face_t *face = getFaceVec(&full->faces, t->face[i]);
+        now[i].diameter = face->diameter;
+        cellBox(face, &now[i]);
+    }
+    if (ok) bufPrintf(report, "%ld towers built in full\n", t->count);
+    return ok;
+}
+
+bool deltaTowers(char *state, char *towers, char *polygon, char *out, bool sorted) {
+    size_t csvLen, polygonLen;
+    char *csv = readFile(towers, &csvLen),
+         *vertices = readFile(polygon, &polygonLen);
+    diagram_t *full = vorCreate();
+    if (full == NULL) {
+        printf("malloc failed, exiting...\n");
+        exit(EXIT_FAILURE);
+    }
+    buffer_t buf = {0}, trace = {0}, report = {0};
+
+    // Warnings about rejected towers go to stdout like stage 3/4's
+    vorTrace(full, &trace);
+    bool ok = vorRead34(full, csv, csvLen, vertices, polygonLen) == VOR_OK;
+    if (!ok) printf("%s, exiting...\n", vorError(full));
+
+    towers_t *t = &full->towers;
+    saved_t *now = ok ? safeMalloc(max(t->count, 1) * sizeof(saved_t)) : NULL;
+    uint64_t hash = ok ? polygonHash(full) : 0;
+    state_t s;
+    bool usable = ok && loadState(state, hash, &s);
+
+    if (usable) {
+        ok = applyDelta(full, &s, vertices, polygonLen, now, &usable, &report);
+        if (!usable) {
+            // The checks are traced again by the full build
+            trace.size = 0;
+            free(s.saved);
+            free(s.text);
+        }
+    }
+    if (ok && !usable) ok = fullBuild(full, &buf, sorted, now, &report);
+
+    if (ok && usable) {
+        // Unchanged towers keep their saved diameters, only the rows
+        // are written again
+        cell_t *cells = safeMalloc(max(t->count, 1) * sizeof(cell_t));
+        long n = 0;
+        for (long i = 0; i < t->count; i++) {
+            if (!isnan(now[i].diameter)) {
+                cells[n++] = (cell_t) {.diameter = now[i].diameter, .row = i, .tower = i};
+            }
+        }
+        if (sorted) qsort(cells, n, sizeof(cell_t), compareCells);
+        for (long i = 0; i < n; i++) printTower(&buf, t, cells[i].tower, cells[i].diameter);
+        free(cells);
+        free(s.saved);
+        free(s.text);
+    }
+    if (trace.size > 0) fwrite(trace.data, 1, trace.size, stdout);
+    if (report.size > 0) fwrite(report.data, 1, report.size, stdout);
+
+    if (ok) {
+        FILE *f = safeOpen(out, "w");
+        if (buf.size > 0) fwrite(buf.data, 1, buf.size, f);
+        ok = !buf.failed && !ferror(f);
+        ok &= fclose(f) == 0;
+        if (!ok) printf("cannot write %s\n", out);
+    }
+    if (ok) ok = storeState(state, hash, t, now);
+
+    free(now);
+    bufFree(&buf);
+    bufFree(&trace);
+    bufFree(&report);
+    vorDestroy(full);
+    free(csv);
+    free(vertices);
+    return ok;
+}
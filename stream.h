@@ -0,0 +1,43 @@
+// Builds stage 3/4 output for tower sets too large to hold in memory
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+
+// Streams a tower file through the engine one tile at a time, given the
+// tower file, polygon file, output file and the number of towers per tile
+// (as a string, from the command line), sorting like stage 4 if requested.
+//
+// The towers are split on disk into tiles, each built with a halo of
+// neighbouring towers around it. Only the cells of towers in a tile's core
+// are written, so memory is bounded by the tile size. A tile whose cells
+// could still be changed by towers outside its halo is built again with a
+// wider one, so the cells are the same as building everything at once.
+// Tiles are split off and their outputs merged a batch at a time, so there
+// can be any number of them. Returns false if it failed
+bool streamTowers(char *, char *, char *, char *, bool);
+
+// Writes the stage 3/4 rows of only the towers whose cells overlap a
+// window, given the tower file, polygon file, output file and the left,
+// bottom, right and top of the window (as strings, from the command line).
+//
+// Towers are bucketed in memory, and only those within a halo around the
+// window are built, widening the halo like a tile's until the cells over
+// the window are the same as building everything. Returns false if it failed
+bool windowTowers(char *, char *, char *, char **, bool);
+
+// Writes stage 3/4 output for a tower file that has changed since the last
+// run, given the state file, tower file, polygon file and output file.
+//
+// The state file keeps the diameter and cell bounds of each tower by id.
+// Towers added, removed or moved since are found by id, and only the cells
+// within the old cells of the towers taken away and the new cells of those
+// put in are built again, each as a window. Every other row keeps its saved
+// diameter. Without a state file for the same polygon, or if ids aren't
+// unique, everything is built and traced like stage 3/4; a run that only
+// builds windows traces just the rejected towers. The state is then
+// updated. Returns false if it failed
+bool deltaTowers(char *, char *, char *, char *, bool);
+
+#endif
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Cached stage 3/4 results must be the same as building: a hit on the same
+# inputs however they are written, a stored entry whose inputs differ (a
+# hash collision) rebuilt, and the least recently used entry evicted
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+    echo "cache test failed: $1"
+    exit 1
+}
+
+# Runs a stage with the cache in $cache, checking output and trace against
+# the uncached run: run <stage> <towers>
+run() {
+    VORONOI2_CACHE="$cache" ./voronoi2 "$1" "$dir/$2.csv" "$dir/polygon.txt" \
+        "$dir/out.txt" > "$dir/trace.txt"
+    cmp -s "$dir/$2.$1.txt" "$dir/out.txt" || fail "stage $1 output of $2 differs"
+    cmp -s "$dir/$2.$1.trace" "$dir/trace.txt" || fail "stage $1 trace of $2 differs"
+}
+
+# Prints the entries in $cache that aren't in the listing given
+newEntry() {
+    ls "$cache" | grep -vxF "$1"
+}
+
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+for seed in 1 2 3; do
+    awk -v n=1000 -v seed=$seed -f tests/towers.awk > "$dir/t$seed.csv"
+done
+# The same towers with their coordinates written differently
+awk -F, -v OFS=, 'NR > 1 { $5 = $5 "0"; $6 = $6 "00" } 1' "$dir/t1.csv" > "$dir/t1b.csv"
+for towers in t1 t1b t2 t3; do
+    for stage in 3 4; do
+        ./voronoi2 $stage "$dir/$towers.csv" "$dir/polygon.txt" "$dir/$towers.$stage.txt" \
+            > "$dir/$towers.$stage.trace"
+    done
+done
+
+# A miss stores the entry, and a hit uses it in place
+cache="$dir/hits"
+run 3 t1
+entry=$(newEntry "")
+inode=$(ls -i "$cache/$entry")
+run 3 t1b
+[ "$(ls "$cache")" = "$entry" ] || fail "reformatted inputs were not a hit"
+[ "$(ls -i "$cache/$entry")" = "$inode" ] || fail "hit rewrote the entry"
+run 4 t1
+[ "$(ls "$cache" | wc -l)" -eq 2 ] || fail "stage 4 shared stage 3's entry"
+
+# t1's entry stored under t2's key is a collision, not a hit
+before=$(ls "$cache")
+run 3 t2
+cp "$cache/$entry" "$cache/$(newEntry "$before")"
+run 3 t2
+
+# With room for two entries, using t1 again makes t2 the one evicted
+cache="$dir/lru"
+run 3 t1
+first=$(newEntry "")
+run 3 t2
+second=$(newEntry "$first")
+run 3 t1
+VORONOI2_CACHE_MB=1 VORONOI2_CACHE="$cache" ./voronoi2 3 "$dir/t3.csv" "$dir/polygon.txt" \
+    "$dir/out.txt" > /dev/null
+cmp -s "$dir/t3.3.txt" "$dir/out.txt" || fail "stage 3 output of t3 differs"
+[ -f "$cache/$first" ] || fail "most recently used entry evicted"
+[ ! -f "$cache/$second" ] || fail "least recently used entry kept"
+[ "$(ls "$cache" | wc -l)" -eq 2 ] || fail "eviction left $(ls "$cache" | wc -l) entries"
+
+echo "cache test passed"
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Stages 1 and 2 split a large pair file between threads; the output must
+# match one thread, however the numbers are written, and a bad row must
+# end the output in whichever chunk it falls
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+    echo "chunks test failed: $1"
+    exit 1
+}
+
+# The same pairs written three ways: plain decimals (read without strtod),
+# exponents, and too many digits for the fast path (read by strtod)
+awk -v dir="$dir" 'BEGIN {
+    s = 7
+    for (i = 0; i < 160000; i++) {
+        for (j = 0; j < 4; j++) {
+            s = s * 16807 % 2147483647
+            v[j] = s % 100000 / 1000
+        }
+        printf "%.3f %.3f %.3f %.3f\n", v[0], v[1], v[2], v[3] > (dir "/plain.txt")
+        printf "%.4e %.4e %.4e %.4e\n", v[0], v[1], v[2], v[3] > (dir "/exp.txt")
+        printf "%.20f %.20f %.20f %.20f\n", v[0], v[1], v[2], v[3] > (dir "/long.txt")
+        if (i == 130000) print "1 2 three 4" > (dir "/bad.txt")
+        if (i < 130000) printf "%.3f %.3f %.3f %.3f\n", v[0], v[1], v[2], v[3] > (dir "/cut.txt")
+        printf "%.3f %.3f %.3f %.3f\n", v[0], v[1], v[2], v[3] > (dir "/bad.txt")
+    }
+}'
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+
+# Four chunks need at least four times voronoi.c's MIN_CHUNK
+[ "$(wc -c < "$dir/plain.txt")" -ge 4194304 ] || fail "pair file too small to split"
+
+VORONOI2_THREADS=1 ./voronoi2 1 "$dir/plain.txt" "$dir/one1.txt"
+VORONOI2_THREADS=1 ./voronoi2 2 "$dir/plain.txt" "$dir/polygon.txt" "$dir/one2.txt"
+VORONOI2_THREADS=1 ./voronoi2 1 "$dir/cut.txt" "$dir/cut1.txt"
+VORONOI2_THREADS=1 ./voronoi2 2 "$dir/cut.txt" "$dir/polygon.txt" "$dir/cut2.txt"
+[ "$(wc -l < "$dir/one1.txt")" -eq 160000 ] || fail "stage 1 missed rows"
+
+for input in plain exp long; do
+    VORONOI2_THREADS=4 ./voronoi2 1 "$dir/$input.txt" "$dir/$input.1.txt"
+    VORONOI2_THREADS=4 ./voronoi2 2 "$dir/$input.txt" "$dir/polygon.txt" "$dir/$input.2.txt"
+    cmp -s "$dir/one1.txt" "$dir/$input.1.txt" || fail "stage 1 differs for $input numbers"
+    cmp -s "$dir/one2.txt" "$dir/$input.2.txt" || fail "stage 2 differs for $input numbers"
+done
+
+VORONOI2_THREADS=4 ./voronoi2 1 "$dir/bad.txt" "$dir/bad1.txt"
+VORONOI2_THREADS=4 ./voronoi2 2 "$dir/bad.txt" "$dir/polygon.txt" "$dir/bad2.txt"
+cmp -s "$dir/cut1.txt" "$dir/bad1.txt" || fail "stage 1 kept rows after a bad row"
+cmp -s "$dir/cut2.txt" "$dir/bad2.txt" || fail "stage 2 kept rows after a bad row"
+
+echo "chunks test passed"
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Delta mode writes the same output as stage 3/4 on each run, whether it
+# builds everything (with stage 3/4's trace) or only the cells near towers
+# added, removed or moved since the state file was written
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+    echo "delta test failed: $1"
+    exit 1
+}
+
+awk -v n=3000 -v seed=6 -f tests/towers.awk > "$dir/a.csv"
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+# Some towers removed, some moved and some added
+awk -F, -v OFS=, '
+    NR > 11 && NR <= 21 { next }
+    NR > 101 && NR <= 106 { $5 = ($5 + 7.25) % 100; $6 = ($6 + 3.5) % 100 }
+    { print }
+    END {
+        for (i = 0; i < 5; i++) {
+            printf "N%04d,3100,%d,Person N%d,%f,%f\n", i, 100 * i, i, 11.5 + 17 * i, 88.25 - 15 * i
+        }
+    }' "$dir/a.csv" > "$dir/b.csv"
+
+for stage in 3 4; do
+    state="$dir/state$stage"
+    : > "$state"
+    for towers in a b b a; do
+        ./voronoi2 $stage "$dir/$towers.csv" "$dir/polygon.txt" "$dir/stage.txt" \
+            > "$dir/trace.txt"
+        ./voronoi2 d $stage "$state" "$dir/$towers.csv" "$dir/polygon.txt" "$dir/delta.txt" \
+            > "$dir/run.txt"
+        cmp -s "$dir/stage.txt" "$dir/delta.txt" || fail "stage $stage differs on $towers"
+        cat "$dir/run.txt" >> "$dir/runs$stage.txt"
+    done
+    # The first run, a full build of a, is traced like the last stage 3/4
+    # run on a, before its report
+    head -n "$(wc -l < "$dir/trace.txt")" "$dir/runs$stage.txt" | cmp -s - "$dir/trace.txt" ||
+        fail "stage $stage full build trace differs"
+    # Only the first run builds everything
+    grep -c 'built in full' "$dir/runs$stage.txt" | grep -qx 1 || fail "stage $stage rebuilt in full"
+    grep -q '^5 towers added, 10 removed and 5 moved' "$dir/runs$stage.txt" ||
+        fail "stage $stage missed changed towers"
+done
+
+echo "delta test passed"
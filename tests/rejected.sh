@@ -0,0 +1,71 @@
+#!/bin/sh
+# A tower file whose towers are all rejected gives no cells in any mode,
+# rather than the first tower keeping the whole polygon, and rejected
+# towers among kept ones change nothing
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/towers.csv" <<CSV
+Watchtower ID,Postcode,Population Served,Watchtower Point of Contact Name,x,y
+X,3000,100,Person X,150,150
+Y,3001,200,Person Y,-20,50
+CSV
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+: > "$dir/state"
+
+./voronoi2 3 "$dir/towers.csv" "$dir/polygon.txt" "$dir/stage3.txt" > "$dir/trace.txt"
+./voronoi2 4 "$dir/towers.csv" "$dir/polygon.txt" "$dir/stage4.txt" > /dev/null
+./voronoi2 t 3 "$dir/towers.csv" "$dir/polygon.txt" "$dir/stream.txt" 1 > /dev/null
+./voronoi2 v 3 "$dir/towers.csv" "$dir/polygon.txt" "$dir/window.txt" 0 0 100 100 > /dev/null
+./voronoi2 d 3 "$dir/state" "$dir/towers.csv" "$dir/polygon.txt" "$dir/delta1.txt" > /dev/null
+./voronoi2 d 3 "$dir/state" "$dir/towers.csv" "$dir/polygon.txt" "$dir/delta2.txt" > /dev/null
+
+status=0
+for out in stage3 stage4 stream window delta1 delta2; do
+    if [ -s "$dir/$out.txt" ]; then
+        echo "rejected test failed: $out wrote cells"
+        cat "$dir/$out.txt"
+        status=1
+    fi
+done
+for id in X Y; do
+    if ! grep -q "^Tower $id (row [0-9]*) rejected: outside polygon$" "$dir/trace.txt"; then
+        echo "rejected test failed: tower $id was not reported as rejected"
+        status=1
+    fi
+done
+if grep -q "^@W" "$dir/trace.txt"; then
+    echo "rejected test failed: a rejected tower was traced"
+    status=1
+fi
+
+# Among kept towers, a duplicate and an outside tower leave the same cells
+# as a file without them
+awk -v n=300 -v seed=8 -f tests/towers.awk > "$dir/clean.csv"
+twin=$(sed -n 11p "$dir/clean.csv")
+awk -F, -v twin="$twin" '
+    { print }
+    NR == 50 { split(twin, t, ","); print "D,3100,100,Person D," t[5] "," t[6] }
+    NR == 100 { print "O,3101,200,Person O,100.5,50" }' "$dir/clean.csv" > "$dir/mixed.csv"
+: > "$dir/state"
+for stage in 3 4; do
+    ./voronoi2 $stage "$dir/clean.csv" "$dir/polygon.txt" "$dir/clean.txt" > /dev/null
+    ./voronoi2 $stage "$dir/mixed.csv" "$dir/polygon.txt" "$dir/mixed.txt" > "$dir/trace.txt"
+    ./voronoi2 d $stage "$dir/state" "$dir/mixed.csv" "$dir/polygon.txt" "$dir/delta.txt" > /dev/null
+    for out in mixed delta; do
+        if ! cmp -s "$dir/clean.txt" "$dir/$out.txt"; then
+            echo "rejected test failed: stage $stage $out cells differ without the rejected towers"
+            status=1
+        fi
+    done
+done
+if ! grep -q "^Tower D (row [0-9]*) rejected: duplicate of $(echo "$twin" | cut -d, -f1) (row [0-9]*)$" \
+        "$dir/trace.txt" ||
+        ! grep -q "^Tower O (row [0-9]*) rejected: outside polygon$" "$dir/trace.txt"; then
+    echo "rejected test failed: mixed towers were not reported as rejected"
+    status=1
+fi
+[ $status = 0 ] && echo "rejected test passed"
+exit $status
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Render mode draws one cell and one tower mark for each row stage 3
+# writes, as a PNG of the requested size, and refuses a diagram without
+# cells instead of reading towers that aren't there
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk -v n=300 -v seed=11 -f tests/towers.awk > "$dir/towers.csv"
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+head -n 1 "$dir/towers.csv" > "$dir/empty.csv"
+
+./voronoi2 3 "$dir/towers.csv" "$dir/polygon.txt" "$dir/stage3.txt" > /dev/null
+./voronoi2 r "$dir/towers.csv" "$dir/polygon.txt" "$dir/image.svg" 400 > /dev/null
+./voronoi2 r "$dir/towers.csv" "$dir/polygon.txt" "$dir/image.png" 400 > /dev/null
+
+status=0
+fail() {
+    echo "render test failed: $1"
+    status=1
+}
+
+rows=$(wc -l < "$dir/stage3.txt")
+cells=$(grep -c '^<path fill=' "$dir/image.svg")
+marks=$(grep -o 'h0' "$dir/image.svg" | wc -l)
+[ "$cells" -eq "$rows" ] || fail "$cells cells in the SVG for $rows stage 3 rows"
+[ "$marks" -eq "$rows" ] || fail "$marks tower marks in the SVG for $rows stage 3 rows"
+grep -q '^<svg .* width="400" height="400"' "$dir/image.svg" || fail "SVG is not 400 by 400"
+
+# Signature, then the IHDR chunk's width and height
+header=$(od -An -tx1 -N24 "$dir/image.png" | tr -d ' \n')
+[ "$header" = "89504e470d0a1a0a0000000d494844520000019000000190" ] || \
+    fail "PNG header is $header"
+
+if ./voronoi2 r "$dir/empty.csv" "$dir/polygon.txt" "$dir/empty.svg" 400 > "$dir/empty.txt"; then
+    fail "a tower file without towers was rendered"
+elif ! grep -q '^diagram has no cells' "$dir/empty.txt"; then
+    fail "a tower file without towers gave: $(cat "$dir/empty.txt")"
+fi
+
+[ $status = 0 ] && echo "render test passed"
+exit $status
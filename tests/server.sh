@@ -0,0 +1,44 @@
+#!/bin/sh
+# Server mode keeps its diagram after a bad ADD: a duplicate tower is
+# refused, and the cells are still there to answer LOCATE and ADD after it.
+# A last request without a line break is still answered
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/towers.csv" <<CSV
+Watchtower ID,Postcode,Population Served,Watchtower Point of Contact Name,x,y
+A,3000,100,Person A,25,25
+B,3001,200,Person B,75,25
+C,3002,300,Person C,50,75
+CSV
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+
+printf '%s\n' 'ADD A,3000,100,Person A,25,25' 'LOCATE 20 20' 'ADD D,3003,400,Person D,52,40' \
+    'LOCATE 52 41' 'CELL 5' | ./voronoi2 s "$dir/towers.csv" "$dir/polygon.txt" - > "$dir/out.txt"
+
+cat > "$dir/expected.txt" <<OUT
+ERR tower A is a duplicate of A
+OK 4 A
+OK 6
+OK 6 D
+OK 5 B 200 101.618655 2506.666667 4
+OUT
+
+if ! cmp -s "$dir/out.txt" "$dir/expected.txt"; then
+    echo "server test failed:"
+    diff "$dir/expected.txt" "$dir/out.txt"
+    exit 1
+fi
+
+# The last request is answered even without a line break after it
+printf 'LOCATE 20 20\nLOCATE 80 20' |
+    ./voronoi2 s "$dir/towers.csv" "$dir/polygon.txt" - > "$dir/out.txt"
+printf 'OK 4 A\nOK 5 B\n' > "$dir/expected.txt"
+if ! cmp -s "$dir/out.txt" "$dir/expected.txt"; then
+    echo "server test failed on a last request without a line break:"
+    diff "$dir/expected.txt" "$dir/out.txt"
+    exit 1
+fi
+echo "server test passed"
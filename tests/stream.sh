@@ -0,0 +1,35 @@
+#!/bin/sh
+# Streaming mode writes the same rows as stages 3 and 4, whether the
+# towers fit in one tile or are spread over more tiles than can be open
+# at once, with halos that have to be widened and outputs merged in turns
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk -v n=1500 -v seed=17 -f tests/towers.awk > "$dir/towers.csv"
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+
+status=0
+for stage in 3 4; do
+    ./voronoi2 $stage "$dir/towers.csv" "$dir/polygon.txt" "$dir/full.txt" > /dev/null
+    for size in 2000 100 4; do
+        ./voronoi2 t $stage "$dir/towers.csv" "$dir/polygon.txt" "$dir/stream.txt" $size \
+            > "$dir/summary.txt"
+        if ! cmp -s "$dir/full.txt" "$dir/stream.txt"; then
+            echo "stream test failed: stage $stage with $size towers per tile"
+            diff "$dir/full.txt" "$dir/stream.txt" | head -5
+            status=1
+        fi
+    done
+    # The smallest tiles are more than MAX_OPEN, and some need a wider halo
+    tiles=$(sed -n 's/^1500 towers in \([0-9]*\) tiles, [1-9][0-9]* tile builds repeated.*/\1/p' \
+        "$dir/summary.txt")
+    if [ -z "$tiles" ] || [ "$tiles" -le 256 ]; then
+        echo "stream test failed: unexpected summary $(cat "$dir/summary.txt")"
+        status=1
+    fi
+done
+
+[ $status = 0 ] && echo "stream test passed"
+exit $status
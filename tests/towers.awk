@@ -0,0 +1,16 @@
+# Prints a tower file of n towers spread over 0..100 square, the same for
+# the same seed with any awk: awk -v n=200 -v seed=1 -f tests/towers.awk
+function next_random() {
+    state = (state * 16807) % 2147483647
+    return state / 2147483647
+}
+
+BEGIN {
+    state = seed > 0 ? seed : 1
+    print "Watchtower ID,Postcode,Population Served,Watchtower Point of Contact Name,x,y"
+    for (i = 0; i < n; i++) {
+        x = 100 * next_random()
+        y = 100 * next_random()
+        printf "T%05d,%d,%d,Person %d,%.6f,%.6f\n", i, 3000 + i % 100, 1 + int(9999 * next_random()), i, x, y
+    }
+}
@@ -0,0 +1,64 @@
+#!/bin/sh
+# What-if mode reports each candidate against the diagram as built, with
+# the same diameters stage 3 gives before and after adding it, and rolls
+# it back so a repeated candidate is reported the same. Duplicate and
+# outside candidates are refused by name
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+awk -v n=200 -v seed=5 -f tests/towers.awk > "$dir/towers.csv"
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+twin=$(sed -n 7p "$dir/towers.csv" | cut -d, -f5,6)
+new='C1,3100,500,Person C1,41.5,58.25'
+{
+    head -n 1 "$dir/towers.csv"
+    echo "$new"
+    echo "C2,3101,600,Person C2,$twin"
+    echo 'C3,3102,700,Person C3,150,50'
+    echo "$new"
+} > "$dir/candidates.csv"
+{ cat "$dir/towers.csv"; echo "$new"; } > "$dir/added.csv"
+
+./voronoi2 w "$dir/towers.csv" "$dir/polygon.txt" "$dir/candidates.csv" "$dir/whatif.txt" > /dev/null
+./voronoi2 3 "$dir/towers.csv" "$dir/polygon.txt" "$dir/before.txt" > /dev/null
+./voronoi2 3 "$dir/added.csv" "$dir/polygon.txt" "$dir/after.txt" > /dev/null
+
+status=0
+fail() {
+    echo "what-if test failed: $1"
+    status=1
+}
+
+grep -qx "Candidate C2: duplicate of $(sed -n 7p "$dir/towers.csv" | cut -d, -f1)" \
+    "$dir/whatif.txt" || fail "duplicate candidate not refused"
+grep -qx 'Candidate C3: outside polygon' "$dir/whatif.txt" || fail "outside candidate not refused"
+
+# Both reports of C1, each its line and the neighbour lines under it
+awk '/^Candidate/ { keep = /^Candidate C1:/; n += keep } keep { print > (dir "/c1_" n ".txt") }' \
+    dir="$dir" "$dir/whatif.txt"
+cmp -s "$dir/c1_1.txt" "$dir/c1_2.txt" || fail "C1 reported differently after rolling back"
+
+# Every diameter before and after matches stage 3 without and with C1
+awk -F ', ' '
+    FILENAME ~ /before/ { split($1, id, ": "); split($NF, dia, ": "); before[id[2]] = dia[2]; next }
+    FILENAME ~ /after/ { split($1, id, ": "); split($NF, dia, ": "); after[id[2]] = dia[2]; next }
+    /^Candidate C1:/ {
+        for (i = 1; i <= NF; i++) if ($i ~ /^Diameter of Cell: /) { split($i, dia, ": "); d = dia[2] }
+        if (d != after["C1"]) { print "C1 diameter " d " is " after["C1"] " in stage 3"; bad = 1 }
+        checked++
+    }
+    /^  Watchtower ID: / {
+        split($1, id, ": "); split($3, dia, ": "); split(dia[2], change, " -> ")
+        if (change[1] != before[id[2]] || change[2] != after[id[2]]) {
+            print id[2] " goes " change[1] " -> " change[2] ", stage 3 gives " before[id[2]] " -> " after[id[2]]
+            bad = 1
+        }
+        checked++
+    }
+    END { if (checked < 4) { print "too few what-if lines"; bad = 1 } exit bad }
+' "$dir/before.txt" "$dir/after.txt" "$dir/c1_1.txt" || fail "diameters differ from stage 3"
+
+[ $status = 0 ] && echo "what-if test passed"
+exit $status
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Window mode writes the stage 3/4 rows, in order and with the same
+# diameters, of every tower whose cell could overlap the window; a window
+# over the whole polygon writes all of them
+set -e
+cd "$(dirname "$0")/.."
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+    echo "window test failed: $1"
+    exit 1
+}
+
+awk -v n=2000 -v seed=4 -f tests/towers.awk > "$dir/towers.csv"
+printf '0 0\n0 100\n100 100\n100 0\n' > "$dir/polygon.txt"
+
+for stage in 3 4; do
+    ./voronoi2 $stage "$dir/towers.csv" "$dir/polygon.txt" "$dir/stage.txt" > /dev/null
+
+    ./voronoi2 v $stage "$dir/towers.csv" "$dir/polygon.txt" "$dir/all.txt" 0 0 100 100 > /dev/null
+    cmp -s "$dir/stage.txt" "$dir/all.txt" || fail "stage $stage whole window differs"
+
+    for window in "20 30 35 40" "-50 -50 5 5" "60 0 61 100"; do
+        ./voronoi2 v $stage "$dir/towers.csv" "$dir/polygon.txt" "$dir/window.txt" $window \
+            > /dev/null
+        [ -s "$dir/window.txt" ] || fail "stage $stage window $window is empty"
+        grep -Fx -f "$dir/window.txt" "$dir/stage.txt" > "$dir/kept.txt" || true
+        cmp -s "$dir/kept.txt" "$dir/window.txt" ||
+            fail "stage $stage window $window rows aren't stage $stage rows in order"
+
+        # Every tower inside the window must be written, and no tower
+        # further from it than its cell's diameter
+        set -- $window
+        awk -F, -v l="$1" -v b="$2" -v r="$3" -v t="$4" '
+            NR == FNR {
+                sub(/^Watchtower ID: /, ""); id = $1
+                d = $0; sub(/.*Diameter of Cell: /, "", d)
+                x = $0; sub(/.* x: /, "", x); sub(/,.*/, "", x); x += 0
+                y = $0; sub(/.* y: /, "", y); sub(/,.*/, "", y); y += 0
+                dx = x < l ? l - x : x > r ? x - r : 0
+                dy = y < b ? b - y : y > t ? y - t : 0
+                if (dx * dx + dy * dy > d * d + 1e-9) { print "far " id; bad = 1 }
+                written[id] = 1
+                next
+            }
+            FNR > 1 && $5 >= l && $5 <= r && $6 >= b && $6 <= t && !($1 in written) {
+                print "missing " $1; bad = 1
+            }
+            END { exit bad }' "$dir/window.txt" "$dir/towers.csv" ||
+            fail "stage $stage window $window"
+    done
+done
+
+echo "window test passed"
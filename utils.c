@@ -1,16 +1,35 @@
 /*
- *  Utility functions for safe memory allocation
- *  and a python-inspired implementation dynamic arrays (lists)
+ *  Utility functions for safe memory allocation, arenas, output buffers
+ *  and input parsing
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include<ctype.h>
+#include<stdarg.h>
 #include<stdbool.h>
+#include<stdint.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
 
 #include"utils.h"
 
 #define INIT_SIZE 12
-#define GROWTH_FACTOR 1.5f
+
+// Longest number scanDouble will read
+#define NUMBER_LEN 64
+
+// Arena blocks are at least this large, bigger requests get their own block
+#define BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    block_t *next;
+    size_t size, used;
+    max_align_t data[];
+};
 
 void * safeMalloc(size_t size) {
     void *ptr = malloc(size);
@@ -39,76 +58,338 @@ FILE * safeOpen(const char *path, const char *mode) {
     return f;
 }
 
-list_t * initList(void) {
-    list_t *list = (list_t *) safeMalloc(sizeof(list_t));
+char * readFile(const char *path, size_t *len) {
+    FILE *f = safeOpen(path, "rb");
+    size_t size = 0, cap = BLOCK_SIZE;
+    char *data = safeMalloc(cap);
 
-    *list = (list_t) {.index = 0,
-                      .curSize = 0,
-                      .maxSize = INIT_SIZE,
-                      .arr = safeMalloc(INIT_SIZE * sizeof(void *)),
-                      ._next = NULL,
-                      .freeElem = free};
+    size_t n;
+    while ((n = fread(data + size, 1, cap - size - 1, f)) > 0) {
+        size += n;
+        if (cap - size - 1 == 0) {
+            cap *= 2;
+            data = safeRealloc(data, cap);
+        }
+    }
+    fclose(f);
 
-    return list;
+    data[size] = '\0';
+    *len = size;
+    return data;
 }
 
-void appendList(list_t *list, void *elem) {
-    if (list->curSize == list->maxSize) {
-        list->maxSize = (long) (list->maxSize * GROWTH_FACTOR);
+mapped_t mapFile(const char *path) {
+    FILE *f = safeOpen(path, "rb");
+    struct stat info;
 
-        list->arr = safeRealloc(list->arr, list->maxSize * sizeof(void *));
+    // Anything that can't be mapped (including empty files) is read instead
+    if (fstat(fileno(f), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (data != MAP_FAILED) {
+            fclose(f);
+            return (mapped_t) {.data = data, .len = info.st_size, .mapped = true};
+        }
     }
+    fclose(f);
 
-    list->arr[list->curSize] = elem;
-    list->curSize++;
+    mapped_t file = {.mapped = false};
+    file.data = readFile(path, &file.len);
+    return file;
 }
 
-void * getList(list_t *list, long index) {
-    if (index >= list->curSize) {
-        printf("list index [%ld] out of range (%ld), exiting...\n", 
-               index, list->curSize);
-        exit(EXIT_FAILURE);
+void unmapFile(mapped_t *file) {
+    if (file->mapped) {
+        munmap(file->data, file->len);
+    } else {
+        free(file->data);
     }
-    return list->arr[index];
+    *file = (mapped_t) {0};
 }
 
-void iterList(list_t *list, void **next) {
-    list->index = 0;
-    list->_next = next;
+// Exact powers of ten for fastDouble
+static const double POWERS[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Reads a plain decimal number without strtod, when the result is sure 
+// to be the same: the digits and power of ten are both exact in a double,
+// so one multiplication or division rounds correctly (Clinger's fast path).
+// Returns NULL if the number isn't that simple
+static const char * fastDouble(const char *p, const char *end, double *out) {
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    // strtod would read these as hexadecimal
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) return NULL;
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+
+    for (; p < end && isdigit((unsigned char) *p); p++) {
+        any = true;
+        if (mantissa == 0 && *p == '0') continue;
+        if (++digits > 19) return NULL;
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isdigit((unsigned char) *p); p++) {
+            any = true;
+            exponent--;
+            if (mantissa == 0 && *p == '0') continue;
+            if (++digits > 19) return NULL;
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    if (!any) return NULL;
+
+    // An exponent only counts if it has digits
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negExp = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+')) q++;
+
+        if (q < end && isdigit((unsigned char) *q)) {
+            int e = 0;
+            for (; q < end && isdigit((unsigned char) *q); q++) {
+                if (e > 1000) return NULL;
+                e = e * 10 + (*q - '0');
+            }
+            exponent += negExp ? -e : e;
+            p = q;
+        }
+    }
+
+    if (mantissa == 0) exponent = 0;
+    if (mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) return NULL;
+    double value = (double) mantissa;
+    value = exponent < 0 ? value / POWERS[-exponent] : value * POWERS[exponent];
+    *out = negative ? -value : value;
+    return p;
 }
 
-bool nextList(list_t *list) {
-    if (list->index >= list->curSize) {
-        return false;
+bool scanDouble(const char **cur, const char *end, double *out) {
+    const char *p = *cur;
+    while (p < end && isspace((unsigned char) *p)) p++;
+
+    // Numbers are read from at most NUMBER_LEN - 1 characters either way
+    const char *stopFast = fastDouble(p, min(end, p + NUMBER_LEN - 1), out);
+    if (stopFast != NULL) {
+        *cur = stopFast;
+        return true;
     }
-    
-    if (list->_next == NULL) {
-        return false;
+
+    // strtod needs a terminated string, so copy out the next token
+    char token[NUMBER_LEN];
+    size_t len = 0;
+    while (p + len < end && len < NUMBER_LEN - 1 && !isspace((unsigned char) p[len])) {
+        token[len] = p[len];
+        len++;
     }
+    token[len] = '\0';
+
+    char *stop;
+    *out = strtod(token, &stop);
+    if (stop == token) return false;
 
-    *(list->_next) = list->arr[list->index++];
+    *cur = p + (stop - token);
     return true;
 }
 
-void freeList(list_t *list) {
-    for (int i = 0; i < list->curSize; i++) {
-        if (list->freeElem != NULL) list->freeElem(list->arr[i]);
-    }
+bool scanLine(const char **cur, const char *end, const char **line, size_t *len) {
+    if (*cur >= end) return false;
+
+    const char *newline = memchr(*cur, '\n', end - *cur);
+    if (newline == NULL) newline = end;
 
-    free(list->arr);
-    free(list);
+    *line = *cur;
+    *len = newline - *cur;
+    *cur = newline < end ? newline + 1 : end;
+    return true;
 }
 
-void iiSortList(list_t *list) {
-    // index represents the index of the currently inserting element
-    for (int index = 0; index < list->curSize; index++) {
-        void *end = list->arr[index];
-        
-        int i;
-        for (i = index; i > 0; i--) {
-            if (!list->cmp(list->arr[i-1], end)) break;
-            list->arr[i] = list->arr[i-1];
+// Mixes 64 bits so that every input bit affects every output bit
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashBytes(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    uint64_t h = mix(seed ^ len), word;
+
+    // Whole words, then the remaining bytes zero padded
+    for (; len >= sizeof(word); p += sizeof(word), len -= sizeof(word)) {
+        memcpy(&word, p, sizeof(word));
+        h = mix(h ^ word) + 0x9e3779b97f4a7c15ULL;
+    }
+    if (len > 0) {
+        word = 0;
+        memcpy(&word, p, len);
+        h = mix(h ^ word);
+    }
+    return mix(h);
+}
+
+void * arenaAlloc(arena_t *arena, size_t size) {
+    const size_t align = _Alignof(max_align_t);
+    size = (size + align - 1) / align * align;
+
+    // Find a kept block with enough room before creating a new one
+    block_t *block = arena->head;
+    while (block != NULL && block->used + size > block->size) {
+        block = block->next;
+    }
+
+    if (block == NULL) {
+        size_t blockSize = max(size, BLOCK_SIZE);
+        block = malloc(sizeof(block_t) + blockSize);
+        if (block == NULL) return NULL;
+        *block = (block_t) {.next = NULL, .size = blockSize, .used = 0};
+
+        // Append to the end of the chain so block order is preserved
+        if (arena->first == NULL) {
+            arena->first = block;
+        } else {
+            block_t *last = arena->head;
+            while (last->next != NULL) last = last->next;
+            last->next = block;
         }
-        list->arr[i] = end;
     }
+
+    arena->head = block;
+    void *ptr = (char *) block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arenaReset(arena_t *arena) {
+    for (block_t *block = arena->first; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+    arena->head = arena->first;
+}
+
+mark_t arenaMark(const arena_t *arena) {
+    return (mark_t) {arena->head, arena->head == NULL ? 0 : arena->head->used};
+}
+
+void arenaRewind(arena_t *arena, mark_t mark) {
+    if (mark.block == NULL) {
+        arenaReset(arena);
+        return;
+    }
+
+    // Allocation only moves forward from the head, so the blocks
+    // after the marked one were empty and only need emptying again
+    for (block_t *block = mark.block->next; block != NULL; block = block->next) {
+        block->used = 0;
+    }
+    mark.block->used = mark.used;
+    arena->head = mark.block;
+}
+
+size_t arenaSize(const arena_t *arena) {
+    size_t size = 0;
+    for (block_t *block = arena->first; block != NULL; block = block->next) {
+        size += sizeof(block_t) + block->size;
+    }
+    return size;
+}
+
+void arenaFree(arena_t *arena) {
+    block_t *block = arena->first;
+    while (block != NULL) {
+        block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    *arena = (arena_t) {NULL, NULL};
+}
+
+void * ctxMalloc(ctx_t *ctx, size_t size) {
+    void *ptr = arenaAlloc(&ctx->arena, size);
+    if (ptr == NULL) {
+        ctxFail(ctx, VOR_ENOMEM, "arena allocation of %zu bytes failed", size);
+    }
+    return ptr;
+}
+
+void * ctxRealloc(ctx_t *ctx, void *ptr, size_t oldSize, size_t newSize) {
+    void *new = ctxMalloc(ctx, newSize);
+    memcpy(new, ptr, min(oldSize, newSize));
+    return new;
+}
+
+char * ctxStrndup(ctx_t *ctx, const char *str, size_t n) {
+    char *copy = ctxMalloc(ctx, n + 1);
+    memcpy(copy, str, n);
+    copy[n] = '\0';
+    return copy;
+}
+
+_Noreturn void ctxFail(ctx_t *ctx, int err, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(ctx->msg, sizeof(ctx->msg), fmt, args);
+    va_end(args);
+
+    ctx->err = err;
+    longjmp(ctx->env, err);
+}
+
+// Makes sure there is room for `extra` more bytes and the terminator
+static bool bufReserve(buffer_t *buf, size_t extra) {
+    if (buf->failed) return false;
+    if (buf->size + extra < buf->cap) return true;
+
+    size_t cap = max(buf->cap * 2, buf->size + extra + 1);
+    cap = max(cap, INIT_SIZE * 16);
+    char *data = realloc(buf->data, cap);
+    if (data == NULL) {
+        buf->failed = true;
+        return false;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return true;
+}
+
+void bufPrintf(buffer_t *buf, const char *fmt, ...) {
+    va_list args;
+
+    // Try to print in place first, and only grow if it didn't fit
+    if (!bufReserve(buf, 0)) return;
+    va_start(args, fmt);
+    int n = vsnprintf(buf->data + buf->size, buf->cap - buf->size, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        buf->failed = true;
+        return;
+    }
+
+    if ((size_t) n >= buf->cap - buf->size) {
+        if (!bufReserve(buf, n)) return;
+        va_start(args, fmt);
+        vsnprintf(buf->data + buf->size, buf->cap - buf->size, fmt, args);
+        va_end(args);
+    }
+    buf->size += n;
+}
+
+void bufWrite(buffer_t *buf, const void *data, size_t len) {
+    if (!bufReserve(buf, len)) return;
+    memcpy(buf->data + buf->size, data, len);
+    buf->size += len;
+    buf->data[buf->size] = '\0';
+}
+
+void bufFree(buffer_t *buf) {
+    free(buf->data);
+    *buf = (buffer_t) {0};
 }
@@ -1,47 +1,174 @@
 /*
- *  Utility functions for safe memory allocation
- *  and a python-inspired implementation dynamic arrays (lists)
+ *  Utility functions for safe memory allocation, arenas, output buffers,
+ *  typed vectors and input parsing
  */
 
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <setjmp.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #define max(A, B) (((A) > (B)) ? (A) : (B))
 #define min(A, B) (((A) > (B)) ? (B) : (A))
 
-typedef struct DynamicArray list_t;
+// Error codes reported by the library in place of exiting
+enum {
+    VOR_OK = 0,
+    VOR_ENOMEM,     // an allocation failed
+    VOR_EIO,        // a file could not be opened, read or written
+    VOR_EFORMAT,    // malformed input (bad header, too few vertices etc.)
+    VOR_EGEOMETRY,  // input is well-formed but geometrically degenerate
+    VOR_EINDEX,     // vector index out of range
+    VOR_EARGS       // invalid arguments to a library call
+};
 
-// "generic" dynamic array using void pointers
-// supporting iteration
-struct DynamicArray {
-    long curSize, maxSize;
-    void **arr;
+typedef struct ArenaBlock block_t;
+typedef struct Arena arena_t;
+typedef struct Context ctx_t;
+typedef struct Buffer buffer_t;
 
-    // list iteration
-    long index;
-    void **_next;
+// Bump allocator, everything allocated is released at once
+struct Arena {
+    block_t *head;  // block currently being allocated from
+    block_t *first; // start of the chain, blocks are kept on reset
+};
 
-    // function pointer for how to free
-    void (*freeElem)(void *);
+// Position in an arena to rewind to, discarding everything allocated since
+typedef struct ArenaMark {
+    block_t *block;
+    size_t used;
+} mark_t;
 
-    // comparison function, true if first >= second
-    bool (*cmp)(void *, void *);
+// Error state and memory owned by a single diagram.
+// Failures longjmp back to the library entry point that set `env`
+struct Context {
+    arena_t arena;
+    jmp_buf env;
+    int err;
+    char msg[256];
 };
 
+// A file's contents, from mapFile
+typedef struct MappedFile {
+    char *data;
+    size_t len;
+    bool mapped;
+} mapped_t;
+
+// Growable in-memory output stream, which stops appending after an
+// allocation failure and sets `failed` (similar to ferror)
+struct Buffer {
+    char *data;
+    size_t size, cap;
+    bool failed;
+};
+
+// Defines a dynamic array storing elements of `type` inline, named
+// `vec` with functions append##Name, get##Name etc. Storage is on the 
+// heap and kept by clear##Name, with allocation failures raised on `ctx`.
+// Iterate with a pointer from begin##Name to end##Name, so any number of
+// loops can run over one vector at once. get##Name checks its index 
+// unless NDEBUG is defined. Pointers to elements are invalidated by append
+#define DEFINE_VECTOR(vec, Name, type) \
+    typedef struct { \
+        long size, cap; \
+        type *arr; \
+        ctx_t *ctx; \
+    } vec; \
+    \
+    static inline void init##Name(vec *v, ctx_t *ctx) { \
+        *v = (vec) {.size = 0, .cap = 0, .arr = NULL, .ctx = ctx}; \
+    } \
+    \
+    static inline void reserve##Name(vec *v, long cap) { \
+        if (cap <= v->cap) return; \
+        type *arr = realloc(v->arr, cap * sizeof(type)); \
+        if (arr == NULL) { \
+            ctxFail(v->ctx, VOR_ENOMEM, "vector of %ld " #type " failed", cap); \
+        } \
+        v->arr = arr; \
+        v->cap = cap; \
+    } \
+    \
+    static inline type * append##Name(vec *v, type elem) { \
+        if (v->size == v->cap) reserve##Name(v, max(v->cap * 3 / 2, 12)); \
+        v->arr[v->size] = elem; \
+        return &v->arr[v->size++]; \
+    } \
+    \
+    static inline type * get##Name(const vec *v, long index) { \
+        VECTOR_CHECK(v, index); \
+        return &v->arr[index]; \
+    } \
+    \
+    static inline type * begin##Name(const vec *v) { return v->arr; } \
+    static inline type * end##Name(const vec *v) { return v->arr + v->size; } \
+    static inline void clear##Name(vec *v) { v->size = 0; } \
+    \
+    static inline void free##Name(vec *v) { \
+        free(v->arr); \
+        v->arr = NULL; \
+        v->size = v->cap = 0; \
+    }
+
+#ifdef NDEBUG
+#define VECTOR_CHECK(v, index) ((void) 0)
+#else
+#define VECTOR_CHECK(v, index) \
+    if ((index) < 0 || (index) >= (v)->size) { \
+        ctxFail((v)->ctx, VOR_EINDEX, "vector index [%ld] out of range (%ld)", \
+                (long) (index), (v)->size); \
+    }
+#endif
+
 void * safeMalloc(size_t);
 void * safeRealloc(void *, size_t);
 FILE * safeOpen(const char *, const char *);
 
-list_t * initList(void);
-void appendList(list_t *, void *);
-void * getList(list_t *, long);
-void iterList(list_t *, void **);
-bool nextList(list_t *);
-void freeList(list_t *);
+// Reads an entire file into a NUL-terminated buffer, exits on failure
+char * readFile(const char *, size_t *);
+
+// Maps an entire file into memory (not NUL-terminated), or reads it if it
+// can't be mapped. Exits on failure like readFile
+mapped_t mapFile(const char *);
+void unmapFile(mapped_t *);
+
+// Reads the next number from a buffer, skipping leading whitespace
+// like fscanf's %lf, and advances the cursor past it. Plain decimals
+// are read without strtod, so they don't depend on the locale
+bool scanDouble(const char **, const char *, double *);
+
+// Splits the next line (without its newline) off a buffer, 
+// returns false once the buffer is exhausted
+bool scanLine(const char **, const char *, const char **, size_t *);
+
+// Hashes a run of bytes, not suitable against deliberate collisions
+uint64_t hashBytes(const void *, size_t, uint64_t);
+
+void * arenaAlloc(arena_t *, size_t);
+void arenaReset(arena_t *);
+mark_t arenaMark(const arena_t *);
+void arenaRewind(arena_t *, mark_t);
+// Total bytes held by an arena, used or not
+size_t arenaSize(const arena_t *);
+void arenaFree(arena_t *);
+
+// Allocates from the context's arena, unwinds with VOR_ENOMEM on failure
+void * ctxMalloc(ctx_t *, size_t);
+// Grows an arena allocation by copying it
+void * ctxRealloc(ctx_t *, void *, size_t, size_t);
+// Copies the first n characters of a string into the arena
+char * ctxStrndup(ctx_t *, const char *, size_t);
+// Records an error and unwinds to the current entry point
+_Noreturn void ctxFail(ctx_t *, int, const char *, ...);
 
-// Sorts a List using In-place Insertion Sort
-void iiSortList(list_t *);
+void bufPrintf(buffer_t *, const char *, ...);
+void bufWrite(buffer_t *, const void *, size_t);
+void bufFree(buffer_t *);
 
 #endif
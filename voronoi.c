@@ -0,0 +1,837 @@
+/*
+ *  Library interface for building Voronoi diagrams in memory
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "newshape.h"
+#include "render.h"
+#include "utils.h"
+#include "voronoi.h"
+
+// Stage 1/2 input is only split into chunks of at least this many bytes
+#define MIN_CHUNK (1 << 20)
+
+// Towers located at once ahead of insertion on more than one thread. A
+// batch no bigger than the diagram leaves most guesses near their face,
+// and there is no batch until the diagram has MIN_BATCH cells
+#define MIN_BATCH 256
+#define MAX_BATCH 16384
+
+// Every entry point unwinds here on failure, emptying the diagram if it 
+// was part way through being changed. Internal functions must not use 
+// this themselves, as the jump target has to stay valid until the entry 
+// point returns
+#define GUARD(d) \
+    (d)->ctx.err = VOR_OK; \
+    (d)->dirty = false; \
+    if (setjmp((d)->ctx.env) != 0) { \
+        if ((d)->dirty) clearDiagram(d); \
+        return (d)->ctx.err; \
+    }
+
+static const char *ERRORS[] = {
+    [VOR_OK] = "success",
+    [VOR_ENOMEM] = "out of memory",
+    [VOR_EIO] = "input/output error",
+    [VOR_EFORMAT] = "malformed input",
+    [VOR_EGEOMETRY] = "degenerate geometry",
+    [VOR_EINDEX] = "index out of range",
+    [VOR_EARGS] = "invalid arguments"
+};
+
+diagram_t * vorCreate(void) {
+    diagram_t *d = malloc(sizeof(diagram_t));
+    if (d != NULL) initDiagram(d);
+    return d;
+}
+
+void vorDestroy(diagram_t *d) {
+    if (d == NULL) return;
+    freeDiagram(d);
+    free(d);
+}
+
+void vorReset(diagram_t *d) {
+    clearDiagram(d);
+    d->ctx.err = VOR_OK;
+    d->ctx.msg[0] = '\0';
+}
+
+size_t vorFootprint(const diagram_t *d) {
+    const towers_t *t = &d->towers;
+    size_t size = arenaSize(&d->ctx.arena) + arenaSize(&d->edges);
+    if (d->store != NULL) size += d->frozenCount * sizeof(edge_t);
+
+    size += t->cap * (sizeof(coord_t) + 2 * sizeof(int) + sizeof(size_t)) + t->textCap;
+    size += d->faces.cap * sizeof(face_t) + d->cuts.cap * sizeof(cut_t) +
+            d->boundary.vertices.cap * sizeof(coord_t) + d->boundary.box.cap * sizeof(box_t) +
+            d->journal.edges.cap * sizeof(edgeundo_t) +
+            d->journal.faces.cap * sizeof(faceundo_t);
+    return size;
+}
+
+void vorTrace(diagram_t *d, buffer_t *trace) {
+    d->trace = trace;
+}
+
+void vorThreads(diagram_t *d, int threads) {
+    d->threads = max(threads, 1);
+}
+
+const char * vorError(const diagram_t *d) {
+    return d->ctx.msg[0] != '\0' ? d->ctx.msg : vorStrerror(d->ctx.err);
+}
+
+const char * vorStrerror(int err) {
+    if (err < 0 || err >= (int) (sizeof(ERRORS) / sizeof(*ERRORS))) {
+        return "unknown error";
+    }
+    return ERRORS[err];
+}
+
+// Fails if an output buffer ran out of memory part way through
+static void checkBuffer(diagram_t *d, buffer_t *buf) {
+    if (buf != NULL && buf->failed) {
+        ctxFail(&d->ctx, VOR_ENOMEM, "output buffer allocation failed");
+    }
+}
+
+// Fails unless a kept tower has a cell. The first one claims the
+// interior face, so that is the only face to look at
+static void checkCells(diagram_t *d) {
+    long inside = d->boundary.vertices.size;
+    if (inside >= d->faces.size || getFaceVec(&d->faces, inside)->tower == -1) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram has no cells");
+    }
+}
+
+// Reads two points from a line of four numbers
+static bool scanPair(const char *line, size_t len, coord_t *A, coord_t *B) {
+    const char *end = line + len;
+    double n[4];
+
+    for (int i = 0; i < 4; i++) {
+        if (!scanDouble(&line, end, &n[i])) return false;
+    }
+    *A = (coord_t) {toReal(n[0]), toReal(n[1])};
+    *B = (coord_t) {toReal(n[2]), toReal(n[3])};
+    return true;
+}
+
+// A run of whole lines of stage 1/2 input, handled by one thread
+// into its own output buffer
+typedef struct Chunk {
+    diagram_t *d;
+    const char *start, *end;
+    bool cut;           // stage 2 rather than stage 1
+    buffer_t *out;
+
+    long rows;          // rows written
+    bool stopped;       // reached a row that isn't a pair, which ends the input
+    long badCuts;       // if not -1, the cuts of the row after the last written
+    ctx_t ctx;          // failures of the chunk's own allocations
+    cutvec_t more;
+    pthread_t thread;
+    bool started;
+} chunk_t;
+
+static void * runChunk(void *arg) {
+    chunk_t *c = arg;
+    const char *cur = c->start, *row;
+    size_t rowLen;
+    cuts_t cuts = {.more = &c->more};
+
+    if (setjmp(c->ctx.env) != 0) return NULL;
+
+    while (scanLine(&cur, c->end, &row, &rowLen)) {
+        // Get two points
+        coord_t A, B;
+        if (!scanPair(row, rowLen, &A, &B)) {
+            c->stopped = true;
+            break;
+        }
+
+        if (!c->cut) {
+            // Stage 1 prints its bisector
+            printLine(c->out, bisector(A, B));
+        } else {
+            // Stage 2 should always have 2 intersections
+            findBoundaryCuts(c->d, &cuts, bisector(A, B));
+            if (cuts.size != 2) {
+                c->badCuts = cuts.size;
+                break;
+            }
+            cut_t *i1 = &cuts.first[0],
+                  *i2 = &cuts.first[1];
+
+            bufPrintf(c->out, "From Edge %d (%lf, %lf) to Edge %d (%lf, %lf)\n",
+                      i1->edge->pair->face, toCalc(i1->coord.x), toCalc(i1->coord.y),
+                      i2->edge->pair->face, toCalc(i2->coord.x), toCalc(i2->coord.y));
+        }
+        c->rows++;
+    }
+    return NULL;
+}
+
+// Handles stage 1/2 input split at line breaks into one chunk per thread,
+// then joins the chunks' output in order. Everything after a row that
+// isn't a pair is ignored, just as if the rows were handled one by one
+static void runChunks(diagram_t *d, const char *data, size_t len, bool cut, buffer_t *out) {
+    long n = max(1, min(d->threads, (long) (len / MIN_CHUNK)));
+    chunk_t *chunks = ctxMalloc(&d->ctx, n * sizeof(chunk_t));
+    buffer_t *buffers = ctxMalloc(&d->ctx, n * sizeof(buffer_t));
+    const char *end = data + len, *start = data;
+
+    for (long i = 0; i < n; i++) {
+        const char *split = i == n - 1 ? end : max(start, data + len * (i + 1) / n);
+        const char *newline = memchr(split, '\n', end - split);
+        split = newline == NULL ? end : newline + 1;
+
+        buffers[i] = (buffer_t) {0};
+        chunks[i] = (chunk_t) {.d = d, .start = start, .end = split, .cut = cut,
+                               .out = i == 0 ? out : &buffers[i], .badCuts = -1};
+        initCutVec(&chunks[i].more, &chunks[i].ctx);
+        start = split;
+    }
+
+    // The first chunk is handled by this thread, and any chunk
+    // without a thread of its own after that
+    for (long i = 1; i < n; i++) {
+        chunks[i].started = !pthread_create(&chunks[i].thread, NULL, runChunk, &chunks[i]);
+    }
+    runChunk(&chunks[0]);
+    for (long i = 1; i < n; i++) {
+        if (chunks[i].started) {
+            pthread_join(chunks[i].thread, NULL);
+        } else {
+            runChunk(&chunks[i]);
+        }
+    }
+
+    // Find the first chunk to go wrong or stop early, joining those before
+    long rows = 0, badCuts = -1;
+    int err = VOR_OK;
+    const char *msg = NULL;
+    for (long i = 0; i < n && err == VOR_OK; i++) {
+        chunk_t *c = &chunks[i];
+        if (c->out->failed) {
+            err = VOR_ENOMEM;
+            msg = "output buffer allocation failed";
+            break;
+        }
+        if (i > 0 && c->out->size > 0) bufWrite(out, c->out->data, c->out->size);
+        rows += c->rows;
+
+        if (c->ctx.err != VOR_OK) {
+            err = c->ctx.err;
+            msg = c->ctx.msg;
+        } else if (c->badCuts != -1) {
+            err = VOR_EGEOMETRY;
+            badCuts = c->badCuts;
+        } else if (c->stopped) {
+            break;
+        }
+    }
+
+    for (long i = 0; i < n; i++) {
+        freeCutVec(&chunks[i].more);
+        bufFree(&buffers[i]);
+    }
+    if (badCuts != -1) {
+        ctxFail(&d->ctx, err, "bisector %ld cuts the polygon %ld times", rows + 1, badCuts);
+    } else if (err != VOR_OK) {
+        ctxFail(&d->ctx, err, "%s", msg);
+    }
+}
+
+static void loadPolygon(diagram_t *d, const char *data, size_t len) {
+    if (d->faces.size > 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram already has a polygon");
+    }
+    d->dirty = true;
+    readPolygon(d, data, len);
+}
+
+// Inserts the cell of a tower already in the tower columns
+static void insertTower(diagram_t *d, long i) {
+    d->dirty = true;
+
+    // The first tower to have a cell claims the whole polygon,
+    // whose face comes straight after the exterior faces
+    long inside = d->boundary.vertices.size;
+    face_t *face = getFaceVec(&d->faces, inside);
+    if (face->tower == -1) {
+        d->towers.face[i] = inside;
+        face->tower = i;
+        face->centre = d->towers.coord[i];
+        return;
+    }
+    addCell(d, i);
+}
+
+// Towers a thread walks to their faces ahead of insertion, each walk
+// starting from where its last one ended
+typedef struct Guess {
+    const diagram_t *d;
+    const coord_t *coord;
+    const bool *keep;
+    long *face;
+    long count;
+    pthread_t thread;
+    bool started;
+} guess_t;
+
+static void * runGuesses(void *arg) {
+    guess_t *g = arg;
+    long hint = g->d->hint;
+    for (long i = 0; i < g->count; i++) {
+        g->face[i] = g->keep[i] ? walkToFace(g->d, g->coord[i], hint) : -1;
+        if (g->face[i] != -1) hint = g->face[i];
+    }
+    return NULL;
+}
+
+// Finds the faces a batch of towers lie in as the diagram stands, split
+// between the diagram's threads, with room for one guess_t per thread.
+// Nothing changes the diagram meanwhile
+static void guessFaces(diagram_t *d, guess_t *guesses, long first, long count,
+                       const bool *keep, long *face) {
+    long n = max(1, min(d->threads, count));
+
+    for (long i = 0, start = 0; i < n; i++) {
+        long end = count * (i + 1) / n;
+        guesses[i] = (guess_t) {.d = d, .coord = d->towers.coord + first + start,
+                                .keep = keep + start, .face = face + start,
+                                .count = end - start};
+        start = end;
+    }
+
+    for (long i = 1; i < n; i++) {
+        guesses[i].started = !pthread_create(&guesses[i].thread, NULL, runGuesses,
+                                             &guesses[i]);
+    }
+    runGuesses(&guesses[0]);
+    for (long i = 1; i < n; i++) {
+        if (guesses[i].started) {
+            pthread_join(guesses[i].thread, NULL);
+        } else {
+            runGuesses(&guesses[i]);
+        }
+    }
+}
+
+// Inserts the towers read from the given number on, apart from those 
+// the pre-pass rejects, which would otherwise only be found to be outside
+// after a scan of every face, or break the bisectors as duplicates.
+//
+// Locating a tower's face is most of inserting it, and only reads the
+// diagram. So with more than one thread, a batch of towers is located at
+// once as a prefetch, then inserted serially in order with each walk
+// starting from its guess. addCell itself never runs concurrently.
+// Towers inserted earlier in the batch may have split the guessed face,
+// in which case the walk goes on from there. Either way it ends in the
+// one face containing the tower, so the diagram is the same as a build
+// on one thread
+static void insertBatches(diagram_t *d, long first, long count, bool *keep,
+                          long *guess, guess_t *guesses) {
+    validateTowers(d, first, keep);
+
+    for (long i = 0; i < count; ) {
+        // Guesses are only worth it once there are enough cells to spread
+        // a batch over, the first towers are inserted as they come
+        long cells = d->index - d->boundary.vertices.size, end = count;
+        bool guessed = guess != NULL && cells >= MIN_BATCH;
+        if (guess != NULL) end = min(count, i + max(MIN_BATCH, min(cells, MAX_BATCH)));
+        if (guessed) guessFaces(d, guesses, first + i, end - i, keep + i, guess + i);
+
+        for (; i < end; i++) {
+            if (!keep[i]) continue;
+            if (guessed && guess[i] != -1) d->hint = guess[i];
+            insertTower(d, first + i);
+        }
+    }
+}
+
+// Inserts the towers read from the given number on, as insertBatches.
+// Its scratch arrays are freed on the way out, even if a tower fails,
+// rather than left in the arena for the life of the diagram
+static void insertTowers(diagram_t *d, long first) {
+    long count = d->towers.count - first;
+    bool *keep = malloc(max(count, 1) * sizeof(bool));
+    long *guess = d->threads > 1 ? malloc(max(count, 1) * sizeof(long)) : NULL;
+    guess_t *guesses = d->threads > 1 ? malloc(d->threads * sizeof(guess_t)) : NULL;
+
+    jmp_buf outer;
+    memcpy(outer, d->ctx.env, sizeof(jmp_buf));
+    if (setjmp(d->ctx.env) != 0) {
+        free(keep);
+        free(guess);
+        free(guesses);
+        memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+        longjmp(d->ctx.env, 1);
+    }
+
+    if (keep == NULL || (d->threads > 1 && (guess == NULL || guesses == NULL))) {
+        ctxFail(&d->ctx, VOR_ENOMEM, "tower scratch allocation failed");
+    }
+    insertBatches(d, first, count, keep, guess, guesses);
+
+    free(keep);
+    free(guess);
+    free(guesses);
+    memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+}
+
+// Reads towers and inserts those that were not there before
+static void addTowers(diagram_t *d, const char *data, size_t len) {
+    if (d->faces.size == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "polygon must be loaded before towers");
+    }
+
+    long first = d->towers.count;
+    d->dirty = true;
+    readTowers(d, data, len);
+    insertTowers(d, first);
+}
+
+// Loads the polygon from coordinates rather than text, like loadPolygon
+static void loadVertices(diagram_t *d, const double *xy, size_t n) {
+    if (d->faces.size > 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram already has a polygon");
+    }
+    d->dirty = true;
+
+    clearCoordVec(&d->boundary.vertices);
+    for (size_t i = 0; i < n; i++) {
+        appendCoordVec(&d->boundary.vertices,
+                       (coord_t) {toReal(xy[2 * i]), toReal(xy[2 * i + 1])});
+    }
+    buildPolygon(d);
+}
+
+// Appends towers given as coordinates and inserts them like addTowers
+static void addPoints(diagram_t *d, const double *xy, const int *pop, size_t n) {
+    if (d->faces.size == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "polygon must be loaded before towers");
+    }
+
+    long first = d->towers.count;
+    d->dirty = true;
+    for (size_t i = 0; i < n; i++) {
+        // Named by row, starting from 0, as there is no CSV to name them
+        char id[24];
+        snprintf(id, sizeof(id), "%ld", first + (long) i);
+        appendTower(d, id, "", pop == NULL ? 0 : pop[i], "",
+                    (coord_t) {toReal(xy[2 * i]), toReal(xy[2 * i + 1])});
+    }
+    insertTowers(d, first);
+}
+
+// Lays the edges out for the passes that only read them, unless nothing
+// has been inserted since they last were
+static void freeze(diagram_t *d) {
+    if (d->frozen == NULL) freezeDiagram(d);
+}
+
+// Cells are only measured once construction is done, so this is where
+// the edges are laid out for the passes that read them
+static void measureDiameters(diagram_t *d) {
+    freeze(d);
+    for (face_t *face = beginFaceVec(&d->faces); face != endFaceVec(&d->faces); face++) {
+        face->diameter = diameter(face);
+    }
+}
+
+// Returns pointers to every face in output order, that is by id or by
+// diameter. Only the order is sorted, so faces can still be looked up by id
+static face_t ** measureCells(diagram_t *d, bool sorted) {
+    face_t **order = ctxMalloc(&d->ctx, max(d->faces.size, 1) * sizeof(face_t *));
+
+    measureDiameters(d);
+    for (long i = 0; i < d->faces.size; i++) {
+        order[i] = getFaceVec(&d->faces, i);
+    }
+
+    if (sorted) {
+        qsort(order, d->faces.size, sizeof(face_t *), compareDiameter);
+    }
+    return order;
+}
+
+// Traces each tower and the edges of each face for visualisation.py
+static void traceCells(diagram_t *d, face_t **faces) {
+    for (long i = 0; i < d->faces.size; i++) {
+        face_t *face = faces[i];
+        edge_t *curEdge = face->edge;
+        if (face->tower != -1) {
+            coord_t coord = d->towers.coord[face->tower];
+            bufPrintf(d->trace, "@W%ld %lf %lf\n", i, 
+                      toCalc(coord.x), toCalc(coord.y));
+        }
+        do {
+            if (curEdge == NULL) break;
+            bufPrintf(d->trace, "@E%d %lf %lf %lf %lf\n", curEdge->face,
+                      toCalc(curEdge->start.x), toCalc(curEdge->start.y), 
+                      toCalc(curEdge->end.x), toCalc(curEdge->end.y));
+            curEdge = curEdge->prev;
+        } while (curEdge != face->edge);
+    }
+}
+
+static void writeTowers(diagram_t *d, face_t **faces, buffer_t *out) {
+    // Iterate through faces and print the tower of each
+    for (long i = 0; i < d->faces.size; i++) {
+        if (faces[i]->tower == -1) continue;
+        printTower(out, &d->towers, faces[i]->tower, faces[i]->diameter);
+    }
+}
+
+int vorLoadPolygon(diagram_t *d, const char *data, size_t len) {
+    GUARD(d);
+    loadPolygon(d, data, len);
+    return VOR_OK;
+}
+
+int vorLoadVertices(diagram_t *d, const double *xy, size_t n) {
+    GUARD(d);
+    loadVertices(d, xy, n);
+    return VOR_OK;
+}
+
+int vorAddPoints(diagram_t *d, const double *xy, const int *pop, size_t n) {
+    GUARD(d);
+    addPoints(d, xy, pop, n);
+    return VOR_OK;
+}
+
+int vorAddTowers(diagram_t *d, const char *data, size_t len) {
+    GUARD(d);
+    addTowers(d, data, len);
+    return VOR_OK;
+}
+
+// Checks a tower read after the diagram was built as validateTowers would,
+// returning the face it falls in, or -1 if it is outside the polygon.
+// Sets near to the tower it duplicates, or -1. The nearest tower is the
+// one whose cell the new one falls in, so only that one is measured
+static long placeTower(diagram_t *d, long tower, long *near) {
+    coord_t p = d->towers.coord[tower];
+    face_t *inside = getFaceVec(&d->faces, d->boundary.vertices.size);
+    long id = outsidePolygon(d, p) ? -1 : inside->tower == -1 ? inside->id : locateFace(d, p);
+
+    *near = id == -1 ? -1 : getFaceVec(&d->faces, id)->tower;
+    if (*near != -1 && norm(getVec(d->towers.coord[*near], p)) > DUPLICATE_DISTANCE) {
+        *near = -1;
+    }
+    return id;
+}
+
+// Reads and inserts one tower row, returning its new face or -1 if it is
+// outside the polygon. A row that is rejected or fails part way through
+// is rolled back by the journal, so the diagram stays as it was rather
+// than being emptied
+static int insertRow(diagram_t *d, const char *row, size_t len) {
+    jmp_buf outer;
+    memcpy(outer, d->ctx.env, sizeof(jmp_buf));
+    beginJournal(d);
+
+    if (setjmp(d->ctx.env) != 0) {
+        rollbackJournal(d);
+        d->dirty = false;
+        memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+        longjmp(d->ctx.env, 1);
+    }
+
+    long tower = readTower(d, row, len, d->towers.count + 1);
+    if (tower == -1) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower row is blank");
+    }
+
+    long near, id = placeTower(d, tower, &near);
+    if (id == -1) {
+        rollbackJournal(d);
+        memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+        return -1;
+    }
+    if (near != -1) {
+        ctxFail(&d->ctx, VOR_EGEOMETRY, "tower %s is a duplicate of %s",
+                towerId(&d->towers, tower), towerId(&d->towers, near));
+    }
+
+    insertTower(d, tower);
+    commitJournal(d);
+    memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+    return d->towers.face[tower];
+}
+
+int vorInsertTower(diagram_t *d, const char *row, size_t len, int *face) {
+    GUARD(d);
+    if (d->faces.size == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "polygon must be loaded before towers");
+    }
+
+    *face = insertRow(d, row, len);
+    return VOR_OK;
+}
+
+int vorLocate(diagram_t *d, double x, double y, int *face) {
+    coord_t point = {.x = toReal(x), .y = toReal(y)};
+
+    GUARD(d);
+    if (d->faces.size == 0 || d->towers.count == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram has no cells");
+    }
+
+    *face = (int) locateFace(d, point);
+    return VOR_OK;
+}
+
+// Checks a journal entry is the first for a cell, rather than an
+// exterior face or a cell already changed
+static bool firstChange(face_t *face, faceundovec_t *changed, faceundo_t *undo) {
+    if (face->tower == -1) return false;
+    for (faceundo_t *prev = beginFaceUndoVec(changed); prev != undo; prev++) {
+        if (prev->face == undo->face) return false;
+    }
+    return true;
+}
+
+// Writes a candidate tower's new cell, and each existing cell it changed
+// with its diameter before and after
+static void reportCandidate(diagram_t *d, long tower, buffer_t *out) {
+    towers_t *t = &d->towers;
+    if (t->face[tower] == -1) {
+        bufPrintf(out, "Candidate %s: outside polygon\n", towerId(t, tower));
+        return;
+    }
+
+    // Existing cells changed are the ones whose first edge was replaced
+    faceundovec_t *changed = &d->journal.faces;
+    long neighbours = 0, population = 0;
+    for (faceundo_t *undo = beginFaceUndoVec(changed); undo != endFaceUndoVec(changed); undo++) {
+        face_t *face = getFaceVec(&d->faces, undo->face);
+        if (!firstChange(face, changed, undo)) continue;
+
+        neighbours++;
+        population += t->pop[face->tower];
+    }
+
+    bufPrintf(out, "Candidate %s: x: %lf, y: %lf, Diameter of Cell: %lf, "
+                   "Neighbours: %ld, Neighbour Population: %ld\n", 
+              towerId(t, tower), toCalc(t->coord[tower].x), toCalc(t->coord[tower].y),
+              diameter(getFaceVec(&d->faces, t->face[tower])), neighbours, population);
+
+    for (faceundo_t *undo = beginFaceUndoVec(changed); undo != endFaceUndoVec(changed); undo++) {
+        face_t *face = getFaceVec(&d->faces, undo->face);
+        if (!firstChange(face, changed, undo)) continue;
+
+        bufPrintf(out, "  Watchtower ID: %s, Population Served: %d, "
+                       "Diameter of Cell: %lf -> %lf\n",
+                  towerId(t, face->tower), t->pop[face->tower], face->diameter, diameter(face));
+    }
+}
+
+// Inserts one candidate tower, reports on it and rolls the diagram back.
+// A candidate that fails is reported and rolled back the same way, as the
+// journal records every change before it is made
+static void whatIf(diagram_t *d, const char *row, size_t len, int n, buffer_t *out) {
+    jmp_buf outer;
+    memcpy(outer, d->ctx.env, sizeof(jmp_buf));
+    beginJournal(d);
+
+    if (setjmp(d->ctx.env) == 0) {
+        long tower = readTower(d, row, len, n), near = -1;
+        if (tower != -1 && placeTower(d, tower, &near) == -1) {
+            bufPrintf(out, "Candidate %s: outside polygon\n", towerId(&d->towers, tower));
+        } else if (near != -1) {
+            bufPrintf(out, "Candidate %s: duplicate of %s\n", towerId(&d->towers, tower),
+                      towerId(&d->towers, near));
+        } else if (tower != -1) {
+            insertTower(d, tower);
+            reportCandidate(d, tower, out);
+        }
+    } else {
+        bufPrintf(out, "Candidate %d: %s\n", n, d->ctx.msg);
+        d->ctx.err = VOR_OK;
+    }
+
+    rollbackJournal(d);
+    d->dirty = false;
+    memcpy(d->ctx.env, outer, sizeof(jmp_buf));
+}
+
+int vorWhatIf(diagram_t *d, const char *candidates, size_t len, buffer_t *out) {
+    const char *cur = candidates, *end = candidates + len, *row;
+    size_t rowLen;
+
+    GUARD(d);
+    if (d->towers.count == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram has no towers");
+    }
+
+    // Diameters before any candidate, to compare against
+    for (face_t *face = beginFaceVec(&d->faces); face != endFaceVec(&d->faces); face++) {
+        if (face->tower != -1) face->diameter = diameter(face);
+    }
+
+    readHeader(d, &cur, end);
+    for (int n = 1; scanLine(&cur, end, &row, &rowLen); n++) {
+        whatIf(d, row, rowLen, n, out);
+    }
+
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorFreeze(diagram_t *d) {
+    GUARD(d);
+    freeze(d);
+    return VOR_OK;
+}
+
+int vorMeasure(diagram_t *d) {
+    GUARD(d);
+    measureDiameters(d);
+    return VOR_OK;
+}
+
+int vorWriteTowers(diagram_t *d, buffer_t *out, bool sorted) {
+    GUARD(d);
+    if (d->towers.count == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "diagram has no towers");
+    }
+
+    writeTowers(d, measureCells(d, sorted), out);
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorRenderSvg(diagram_t *d, int width, buffer_t *out) {
+    GUARD(d);
+    checkCells(d);
+    freeze(d);
+    renderSvg(d, width, out);
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorRenderPng(diagram_t *d, int width, buffer_t *out) {
+    GUARD(d);
+    checkCells(d);
+    freeze(d);
+    renderPng(d, width, out);
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorStage1(diagram_t *d, const char *points, size_t len, buffer_t *out) {
+    GUARD(d);
+    d->dirty = true;
+    clearDiagram(d);
+
+    runChunks(d, points, len, false, out);
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorStage2(diagram_t *d, const char *points, size_t pointsLen,
+              const char *polygon, size_t polygonLen, buffer_t *out) {
+    GUARD(d);
+    d->dirty = true;
+    clearDiagram(d);
+
+    // Read the polygon like A1, then cut it with each bisector.
+    // The index is built first, as the threads only read it
+    loadPolygon(d, polygon, polygonLen);
+    indexBoundary(d);
+
+    runChunks(d, points, pointsLen, true, out);
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorRead34(diagram_t *d, const char *towers, size_t towersLen,
+              const char *polygon, size_t polygonLen) {
+    GUARD(d);
+    d->dirty = true;
+    clearDiagram(d);
+
+    loadPolygon(d, polygon, polygonLen);
+    readTowers(d, towers, towersLen);
+    if (d->towers.count == 0) {
+        ctxFail(&d->ctx, VOR_EFORMAT, "tower file has no towers");
+    }
+    return VOR_OK;
+}
+
+int vorCanonical(diagram_t *d, buffer_t *out) {
+    const towers_t *t = &d->towers;
+    const coordvec_t *vertices = &d->boundary.vertices;
+
+    GUARD(d);
+    if (t->count == 0) {
+        ctxFail(&d->ctx, VOR_EARGS, "stage 3/4 inputs must be read first");
+    }
+
+    // Which coordinate build read them, as the same files read
+    // as doubles and as fixed point are different inputs
+    real_t unit = toReal(1.0);
+    size_t size = sizeof(real_t);
+    bufWrite(out, &size, sizeof(size));
+    bufWrite(out, &unit, sizeof(unit));
+
+    bufWrite(out, &vertices->size, sizeof(vertices->size));
+    bufWrite(out, vertices->arr, vertices->size * sizeof(coord_t));
+
+    // The text holds each tower's fields in order, separated by NULs
+    bufWrite(out, &t->count, sizeof(t->count));
+    bufWrite(out, t->coord, t->count * sizeof(coord_t));
+    bufWrite(out, t->pop, t->count * sizeof(int));
+    bufWrite(out, &t->textSize, sizeof(t->textSize));
+    bufWrite(out, t->text, t->textSize);
+
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorCheckTowers(diagram_t *d, bool *keep) {
+    GUARD(d);
+    if (d->towers.count == 0 || d->towers.face[0] != -1) {
+        ctxFail(&d->ctx, VOR_EARGS, "stage 3/4 inputs must be read, and not yet built");
+    }
+
+    validateTowers(d, 0, keep);
+    if (d->trace != NULL) checkBuffer(d, d->trace);
+    return VOR_OK;
+}
+
+int vorBuild34(diagram_t *d, buffer_t *out, bool sorted) {
+    GUARD(d);
+    if (d->towers.count == 0 || d->towers.face[0] != -1) {
+        ctxFail(&d->ctx, VOR_EARGS, "stage 3/4 inputs must be read, and not yet built");
+    }
+
+    insertTowers(d, 0);
+
+    face_t **faces = measureCells(d, sorted);
+    if (d->trace != NULL) {
+        traceCells(d, faces);
+        checkBuffer(d, d->trace);
+    }
+    writeTowers(d, faces, out);
+
+    checkBuffer(d, out);
+    return VOR_OK;
+}
+
+int vorStage34(diagram_t *d, const char *towers, size_t towersLen,
+               const char *polygon, size_t polygonLen, buffer_t *out, bool sorted) {
+    int err = vorRead34(d, towers, towersLen, polygon, polygonLen);
+    return err != VOR_OK ? err : vorBuild34(d, out, sorted);
+}
@@ -0,0 +1,116 @@
+/*
+ *  Library interface for building Voronoi diagrams in memory
+ *
+ *  Each diagram_t owns all of its memory, so separate diagrams can be
+ *  used from different threads at once (a single diagram must not be).
+ *  Functions return VOR_OK or one of the VOR_E* codes instead of exiting,
+ *  in which case vorError describes the failure. A call that fails part way
+ *  through changing the diagram also empties it.
+ */
+
+#ifndef VORONOI_H
+#define VORONOI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "newshape.h"
+
+// Allocates an empty diagram, or NULL if out of memory
+diagram_t * vorCreate(void);
+
+// Frees a diagram and everything in it
+void vorDestroy(diagram_t *);
+
+// Empties a diagram, keeping its memory for the next job
+void vorReset(diagram_t *);
+
+// Bytes a diagram holds, used or not: its arenas, frozen edges,
+// tower columns and vectors
+size_t vorFootprint(const diagram_t *);
+
+// Sets the buffer receiving warnings and @W/@E lines (NULL disables)
+void vorTrace(diagram_t *, buffer_t *);
+
+// Sets how many threads stage 1/2 may split their input between, and
+// how many locate towers ahead of inserting them (default 1)
+void vorThreads(diagram_t *, int);
+
+// Describes the last error
+const char * vorError(const diagram_t *);
+
+// Describes an error code
+const char * vorStrerror(int);
+
+// Loads the bounding polygon into an empty diagram
+int vorLoadPolygon(diagram_t *, const char *, size_t);
+
+// Loads the bounding polygon into an empty diagram from n vertices
+// given as x, y pairs
+int vorLoadVertices(diagram_t *, const double *, size_t);
+
+// Reads a tower CSV and inserts every tower into the diagram
+int vorAddTowers(diagram_t *, const char *, size_t);
+
+// Inserts n towers given as x, y pairs, with the population of each
+// (or NULL for none). Each is named by its row, starting from 0
+int vorAddPoints(diagram_t *, const double *, const int *, size_t);
+
+// Inserts one tower given as a CSV row (without the header),
+// setting the id of its new face or -1 if it lies outside the polygon.
+// A row that duplicates a tower or can't be inserted fails, and leaves
+// the diagram as it was
+int vorInsertTower(diagram_t *, const char *, size_t, int *);
+
+// Sets the id of the face containing a point, or -1 if there is none
+int vorLocate(diagram_t *, double, double, int *);
+
+// Inserts each tower of a candidate CSV on its own, writing its new cell
+// and how the diameters of the cells it cuts into would change, then
+// rolls the diagram back in time proportional to the change. A candidate
+// that can't be inserted is reported and skipped
+int vorWhatIf(diagram_t *, const char *, size_t, buffer_t *);
+
+// Lays the half-edges out in face order, so lookups that only read the
+// diagram walk memory linearly. Measuring and rendering do this too, and
+// any insertion undoes it
+int vorFreeze(diagram_t *);
+
+// Sets the diameter of every face, which vorWriteTowers also does
+int vorMeasure(diagram_t *);
+
+// Writes every tower with the diameter of its cell,
+// sorted by increasing diameter if requested
+int vorWriteTowers(diagram_t *, buffer_t *, bool);
+
+// Draws the cells coloured by face id, with their edges and towers, as an
+// image of the given width in pixels whose height follows the polygon.
+// The SVG has one path per cell, the PNG is filled by a scanline rasteriser.
+// Fails with VOR_EARGS if no tower has a cell
+int vorRenderSvg(diagram_t *, int, buffer_t *);
+int vorRenderPng(diagram_t *, int, buffer_t *);
+
+// Stage 1: bisectors of each point pair
+int vorStage1(diagram_t *, const char *, size_t, buffer_t *);
+
+// Stage 2: intersections of each bisector with the polygon
+int vorStage2(diagram_t *, const char *, size_t, const char *, size_t, buffer_t *);
+
+// Stage 3/4: tower and polygon buffers in, tower rows out
+int vorStage34(diagram_t *, const char *, size_t, const char *, size_t,
+               buffer_t *, bool);
+
+// Stage 3/4 in two steps: reads the tower and polygon buffers into an
+// empty diagram, then builds and writes it like vorStage34
+int vorRead34(diagram_t *, const char *, size_t, const char *, size_t);
+int vorBuild34(diagram_t *, buffer_t *, bool);
+
+// Appends the stage 3/4 inputs as read, between vorRead34 and vorBuild34,
+// in a form that doesn't depend on how the files were laid out
+int vorCanonical(diagram_t *, buffer_t *);
+
+// Sets whether each tower read by vorRead34 would be kept by vorBuild34,
+// tracing why the others would be rejected, without building anything
+int vorCheckTowers(diagram_t *, bool *);
+
+#endif